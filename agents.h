@@ -0,0 +1,140 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "thread_pool.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define AGENTS_SSE2
+#endif
+
+
+// Agents driving on the (i, j) torus grid, which wraps around in both directions,
+// stored as a structure of arrays so that a step streams through plain float
+// arrays. Headings are unit vectors and speeds are in grid cells per second.
+class Agents {
+
+    private:
+
+    glm::vec2 grid_size;
+
+    std::vector<float> i;
+    std::vector<float> j;
+    std::vector<float> di;
+    std::vector<float> dj;
+    std::vector<float> speed;
+
+    // Moves one coordinate array by d * speed * dt and wraps it into [0, size);
+    // an agent moves less than the grid size per step.
+    static void advance(float* p, const float* d, const float* v, size_t count, float dt, float size) {
+        size_t k = 0;
+
+#if defined(__AVX2__)
+        __m256 v_dt = _mm256_set1_ps(dt);
+        __m256 v_size = _mm256_set1_ps(size);
+        __m256 zero = _mm256_setzero_ps();
+        for (; k + 8 <= count; k += 8) {
+            __m256 step = _mm256_mul_ps(_mm256_mul_ps(_mm256_loadu_ps(d + k), _mm256_loadu_ps(v + k)), v_dt);
+            __m256 x = _mm256_add_ps(_mm256_loadu_ps(p + k), step);
+            x = _mm256_add_ps(x, _mm256_and_ps(_mm256_cmp_ps(x, zero, _CMP_LT_OQ), v_size));
+            x = _mm256_sub_ps(x, _mm256_and_ps(_mm256_cmp_ps(x, v_size, _CMP_GE_OQ), v_size));
+            _mm256_storeu_ps(p + k, x);
+        }
+#elif defined(AGENTS_SSE2)
+        __m128 v_dt = _mm_set1_ps(dt);
+        __m128 v_size = _mm_set1_ps(size);
+        __m128 zero = _mm_setzero_ps();
+        for (; k + 4 <= count; k += 4) {
+            __m128 step = _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(d + k), _mm_loadu_ps(v + k)), v_dt);
+            __m128 x = _mm_add_ps(_mm_loadu_ps(p + k), step);
+            x = _mm_add_ps(x, _mm_and_ps(_mm_cmplt_ps(x, zero), v_size));
+            x = _mm_sub_ps(x, _mm_and_ps(_mm_cmpge_ps(x, v_size), v_size));
+            _mm_storeu_ps(p + k, x);
+        }
+#endif
+
+        for (; k < count; k++) {
+            float x = p[k] + d[k] * v[k] * dt;
+            x += x < 0 ? size : 0;
+            x -= x >= size ? size : 0;
+            p[k] = x;
+        }
+    }
+
+    public:
+
+    Agents(const glm::vec2& grid_size) : grid_size(grid_size) {}
+
+    size_t size() const {
+        return i.size();
+    }
+
+    glm::vec2 get_grid_size() const {
+        return grid_size;
+    }
+
+    void reserve(size_t count) {
+        for (auto* v : { &i, &j, &di, &dj, &speed }) {
+            v->reserve(count);
+        }
+    }
+
+    void clear() {
+        for (auto* v : { &i, &j, &di, &dj, &speed }) {
+            v->clear();
+        }
+    }
+
+    // Returns the index of the new agent.
+    size_t add(const glm::vec2& position, float alpha, float agent_speed) {
+        i.push_back(position[0]);
+        j.push_back(position[1]);
+        di.push_back(std::cos(alpha));
+        dj.push_back(std::sin(alpha));
+        speed.push_back(agent_speed);
+        return i.size() - 1;
+    }
+
+    glm::vec2 get_position(size_t k) const {
+        return glm::vec2(i[k], j[k]);
+    }
+
+    glm::vec2 get_direction(size_t k) const {
+        return glm::vec2(di[k], dj[k]);
+    }
+
+    float get_speed(size_t k) const {
+        return speed[k];
+    }
+
+    void set_heading(size_t k, float alpha) {
+        di[k] = std::cos(alpha);
+        dj[k] = std::sin(alpha);
+    }
+
+    void set_speed(size_t k, float agent_speed) {
+        speed[k] = agent_speed;
+    }
+
+    const float* get_i() const {
+        return i.data();
+    }
+
+    const float* get_j() const {
+        return j.data();
+    }
+
+    // Moves every agent by dt seconds, in parallel over contiguous ranges.
+    void step(float dt, ThreadPool& pool) {
+        pool.parallel_for(0, size(), [this, dt](size_t from, size_t to) {
+            advance(&i[from], &di[from], &speed[from], to - from, dt, grid_size[0]);
+            advance(&j[from], &dj[from], &speed[from], to - from, dt, grid_size[1]);
+        });
+    }
+};
@@ -0,0 +1,67 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <string>
+#include <fmt/format.h>
+
+#include "agents.h"
+#include "spatial_hash.h"
+
+
+// Agents per millisecond for stepping, rebuilding the spatial hash and finding
+// collisions on a torus grid of the default size.
+// Usage: agents_bench [agents count] [steps]
+int main(int argc, char** argv) {
+   size_t agents_count = argc > 1 ? std::stoul(argv[1]) : 100000;
+   int steps = argc > 2 ? std::stoi(argv[2]) : 100;
+
+   glm::vec2 grid_size(2000, 400);
+   float dt = 1.f / 120;
+   float collision_radius = 1.f;
+
+   Agents agents(grid_size);
+   agents.reserve(agents_count);
+   std::mt19937 random(1);
+   std::uniform_real_distribution<float> uniform(0, 1);
+   for (size_t k = 0; k < agents_count; k++) {
+      agents.add(
+         glm::vec2(uniform(random), uniform(random)) * grid_size,
+         2 * 3.14f * uniform(random),
+         41.f * uniform(random)
+      );
+   }
+
+   SpatialHash hash(grid_size, 2 * collision_radius);
+   ThreadPool pool;
+
+   typedef std::chrono::steady_clock Clock;
+   Clock::duration step_time(0), build_time(0), query_time(0);
+   size_t collisions = 0;
+
+   for (int s = 0; s < steps; s++) {
+      auto t0 = Clock::now();
+      agents.step(dt, pool);
+      auto t1 = Clock::now();
+      hash.build(agents, pool);
+      auto t2 = Clock::now();
+      collisions += hash.find_collisions(agents, collision_radius, pool).size();
+      auto t3 = Clock::now();
+
+      step_time += t1 - t0;
+      build_time += t2 - t1;
+      query_time += t3 - t2;
+   }
+
+   auto rate = [&](Clock::duration time) {
+      return agents_count * steps / std::chrono::duration<double, std::milli>(time).count();
+   };
+
+   std::cout << fmt::format("{} agents, {} steps, {} threads\n", agents_count, steps, pool.size());
+   std::cout << fmt::format("step:       {:.0f} agents/ms\n", rate(step_time));
+   std::cout << fmt::format("hash build: {:.0f} agents/ms\n", rate(build_time));
+   std::cout << fmt::format("collisions: {:.0f} agents/ms, {:.1f} pairs per step\n", rate(query_time), double(collisions) / steps);
+   std::cout << fmt::format("total:      {:.0f} agents/ms\n", rate(step_time + build_time + query_time));
+
+   return 0;
+}
@@ -1,6 +1,8 @@
 #pragma once
 #include <GL/glew.h>
 #include "opengl_shader.h"
+#include "gl_state.h"
+#include "profiler.h"
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
@@ -63,7 +65,7 @@ class Environment {
         glGenVertexArrays(1, &vao);
         glGenBuffers(1, &vbo);
         glGenBuffers(1, &ebo);
-        glBindVertexArray(vao);
+        get_gl_state().bind_vertex_array(vao);
         glBindBuffer(GL_ARRAY_BUFFER, vbo);
         glBufferData(GL_ARRAY_BUFFER, sizeof(triangles_vertices), triangles_vertices, GL_STATIC_DRAW);
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
@@ -71,7 +73,7 @@ class Environment {
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void *)0);
         glEnableVertexAttribArray(0);
         glBindBuffer(GL_ARRAY_BUFFER, 0);
-        glBindVertexArray(0);
+        get_gl_state().bind_vertex_array(0);
 
         this->vbo = vbo;
         this->vao = vao;
@@ -81,13 +83,12 @@ class Environment {
 
 
     void render(shader_t& shader, GLuint texture) {
-
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+        PROFILE_ZONE("Environment::render");
 
         shader.use();
+        shader.set_uniform("environment", get_gl_state().bind_texture(GL_TEXTURE_CUBE_MAP, texture));
 
-        glBindVertexArray(vao);
+        get_gl_state().bind_vertex_array(vao);
         glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
     }
 
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <array>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "opengl_shader.h"
+#include "shadow_cascades.h"
+
+
+// Matrices shared by the programs of a frame, uploaded once into a uniform buffer
+// declared in shaders/frame_uniforms.glsl (std140, so mat4 and vec4 members are packed as is).
+class FrameUniforms {
+
+    private:
+
+    struct Block {
+        glm::mat4 view;
+        glm::mat4 projection;
+        std::array<glm::mat4, ShadowCascades::count> shadow_matrices;
+        glm::vec4 cascade_splits;
+    };
+
+    static_assert(sizeof(Block) == (2 + ShadowCascades::count) * 64 + 16, "FrameUniforms must match the std140 layout");
+
+    GLuint buffer;
+    GLuint binding;
+
+    public:
+
+    FrameUniforms(GLuint binding = 0)
+      : binding(binding)
+    {
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(Block), nullptr, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer);
+    }
+
+    ~FrameUniforms() {
+        glDeleteBuffers(1, &buffer);
+    }
+
+    FrameUniforms(const FrameUniforms&) = delete;
+    FrameUniforms& operator=(const FrameUniforms&) = delete;
+
+    void attach(shader_t& shader) {
+        shader.bind_uniform_block("FrameUniforms", binding);
+    }
+
+    void update(
+        const glm::mat4& view,
+        const glm::mat4& projection,
+        const std::array<glm::mat4, ShadowCascades::count>& shadow_matrices,
+        const glm::vec4& cascade_splits
+    ) {
+        Block block { view, projection, shadow_matrices, cascade_splits };
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(Block), &block);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+};
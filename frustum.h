@@ -0,0 +1,50 @@
+#pragma once
+
+#include <array>
+#include <glm/glm.hpp>
+
+
+// Clip space planes of a view-projection (or model-view-projection) matrix,
+// used to reject bounding boxes and spheres given in the matrix input space.
+class Frustum {
+
+    private:
+
+    std::array<glm::vec4, 6> planes;
+
+    static glm::vec4 row(const glm::mat4& m, int k) {
+        return glm::vec4(m[0][k], m[1][k], m[2][k], m[3][k]);
+    }
+
+    public:
+
+    Frustum(const glm::mat4& m) {
+        for (int k = 0; k < 3; k++) {
+            planes[2 * k] = row(m, 3) + row(m, k);
+            planes[2 * k + 1] = row(m, 3) - row(m, k);
+        }
+    }
+
+    bool intersects(const glm::vec3& min, const glm::vec3& max) const {
+        for (auto& p : planes) {
+            glm::vec3 v(
+                p.x > 0 ? max.x : min.x,
+                p.y > 0 ? max.y : min.y,
+                p.z > 0 ? max.z : min.z
+            );
+            if (p.x * v.x + p.y * v.y + p.z * v.z + p.w < 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool intersects(const glm::vec3& center, float radius) const {
+        for (auto& p : planes) {
+            if (glm::dot(glm::vec3(p), center) + p.w < -radius * glm::length(glm::vec3(p))) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
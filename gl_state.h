@@ -0,0 +1,146 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <GL/glew.h>
+
+
+// Shadow of the GL binding state for programs, vertex arrays and textures, so that
+// binding what is already bound costs nothing. Everything in the program binds
+// through get_gl_state(); code that changes these bindings directly (the ImGui
+// backend) must restore them, and deleted textures must be forgotten.
+//
+// Textures get units in the order they are first bound, and keep them until all
+// units are taken, after which the least recently bound texture gives its unit up.
+// Sampler uniforms are set from the unit bind_texture returns.
+class GLState {
+
+    private:
+
+    struct Unit {
+        GLenum target = 0;
+        GLuint texture = 0;
+        uint64_t last_use = 0;
+    };
+
+    GLuint program = 0;
+    GLuint vertex_array = 0;
+    GLint active_unit = 0;
+    std::vector<Unit> units;
+    uint64_t uses = 0;
+
+    size_t calls_count = 0;
+    size_t skipped_count = 0;
+
+    void set_active_unit(GLint unit) {
+        if (unit == active_unit) {
+            skipped_count++;
+            return;
+        }
+        glActiveTexture(GL_TEXTURE0 + unit);
+        active_unit = unit;
+        calls_count++;
+    }
+
+    GLint find_unit(GLenum target, GLuint texture) {
+        GLint free = -1;
+        GLint oldest = 0;
+        for (size_t k = 0; k < units.size(); k++) {
+            if (units[k].texture == texture && units[k].target == target) {
+                return k;
+            }
+            if (free < 0 && units[k].texture == 0) {
+                free = k;
+            }
+            if (units[k].last_use < units[oldest].last_use) {
+                oldest = k;
+            }
+        }
+        return free >= 0 ? free : oldest;
+    }
+
+    public:
+
+    GLState() {
+        GLint units_count = 0;
+        glGetIntegerv(GL_MAX_COMBINED_TEXTURE_IMAGE_UNITS, &units_count);
+        units.resize(units_count);
+    }
+
+    GLState(const GLState&) = delete;
+    GLState& operator=(const GLState&) = delete;
+
+    void use_program(GLuint id) {
+        if (id == program) {
+            skipped_count++;
+            return;
+        }
+        glUseProgram(id);
+        program = id;
+        calls_count++;
+    }
+
+    void bind_vertex_array(GLuint id) {
+        if (id == vertex_array) {
+            skipped_count++;
+            return;
+        }
+        glBindVertexArray(id);
+        vertex_array = id;
+        calls_count++;
+    }
+
+    // Binds the texture on its unit and makes that unit active, so that the texture
+    // can also be updated with glTex* calls right after; returns the unit.
+    GLint bind_texture(GLenum target, GLuint texture) {
+        GLint unit = find_unit(target, texture);
+        Unit& u = units[unit];
+        u.last_use = ++uses;
+        set_active_unit(unit);
+
+        if (u.texture == texture && u.target == target) {
+            skipped_count++;
+            return unit;
+        }
+        if (u.texture != 0 && u.target != target) {
+            glBindTexture(u.target, 0);
+            calls_count++;
+        }
+        glBindTexture(target, texture);
+        u.target = target;
+        u.texture = texture;
+        calls_count++;
+        return unit;
+    }
+
+    // To be called with glDeleteTextures: GL unbinds a deleted texture, and a new one
+    // may get its name, which would otherwise look bound already.
+    void forget_texture(GLuint texture) {
+        for (Unit& u : units) {
+            if (u.texture == texture) {
+                u = Unit();
+            }
+        }
+    }
+
+    size_t get_calls_count() {
+        return calls_count;
+    }
+
+    // Calls not made because they would not have changed anything.
+    size_t get_skipped_count() {
+        return skipped_count;
+    }
+
+    void reset_counts() {
+        calls_count = 0;
+        skipped_count = 0;
+    }
+};
+
+
+// The state of the one GL context, created on first use after GLEW is initialized.
+inline GLState& get_gl_state() {
+    static GLState state;
+    return state;
+}
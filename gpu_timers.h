@@ -0,0 +1,188 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <array>
+#include <fstream>
+#include <cstdint>
+#include <stdexcept>
+#include <GL/glew.h>
+
+
+// GPU time of named passes measured with GL_TIME_ELAPSED queries. Each pass has a ring
+// of queries a few frames deep, and results are read once available, so the CPU never
+// waits for them; a pass whose query in the ring is still pending goes untimed that frame.
+class GpuTimers {
+
+    public:
+
+    static constexpr size_t frames_in_flight = 4;
+    static constexpr size_t history_size = 240;
+
+    struct Sample {
+        uint64_t frame;
+        float ms;
+    };
+
+    private:
+
+    struct Pass {
+        std::string name;
+        std::array<GLuint, frames_in_flight> queries;
+        std::array<uint64_t, frames_in_flight> query_frames;
+        std::array<bool, frames_in_flight> pending;
+        std::vector<Sample> history;
+        std::vector<float> history_ms;
+        double total_ms = 0;
+        size_t samples_count = 0;
+    };
+
+    std::vector<Pass> passes;
+    bool supported;
+    int active = -1;
+    uint64_t frame = 0;
+
+    size_t get_pass(const std::string& name) {
+        for (size_t k = 0; k < passes.size(); k++) {
+            if (passes[k].name == name) {
+                return k;
+            }
+        }
+
+        Pass pass;
+        pass.name = name;
+        glGenQueries(frames_in_flight, pass.queries.data());
+        pass.query_frames.fill(0);
+        pass.pending.fill(false);
+        passes.push_back(std::move(pass));
+        return passes.size() - 1;
+    }
+
+    void add_sample(Pass& pass, uint64_t sample_frame, GLuint64 ns) {
+        pass.history.push_back({ sample_frame, ns / 1e6f });
+        pass.total_ms += ns / 1e6;
+        pass.samples_count++;
+        if (pass.history.size() > history_size) {
+            pass.history.erase(pass.history.begin());
+        }
+        pass.history_ms.clear();
+        for (const Sample& s : pass.history) {
+            pass.history_ms.push_back(s.ms);
+        }
+    }
+
+    public:
+
+    GpuTimers()
+      : supported(GLEW_ARB_timer_query)
+    { }
+
+    ~GpuTimers() {
+        for (auto& pass : passes) {
+            glDeleteQueries(frames_in_flight, pass.queries.data());
+        }
+    }
+
+    GpuTimers(const GpuTimers&) = delete;
+    GpuTimers& operator=(const GpuTimers&) = delete;
+
+    bool is_supported() {
+        return supported;
+    }
+
+    void begin(const std::string& name) {
+        if (!supported) {
+            return;
+        }
+        size_t p = get_pass(name);
+        size_t slot = frame % frames_in_flight;
+        if (passes[p].pending[slot]) {
+            return;
+        }
+        glBeginQuery(GL_TIME_ELAPSED, passes[p].queries[slot]);
+        passes[p].pending[slot] = true;
+        passes[p].query_frames[slot] = frame;
+        active = p;
+    }
+
+    void end() {
+        if (active >= 0) {
+            glEndQuery(GL_TIME_ELAPSED);
+            active = -1;
+        }
+    }
+
+    // Reads the results that have arrived, oldest first, and starts the next frame.
+    void next_frame() {
+        for (auto& pass : passes) {
+            for (size_t k = 1; k <= frames_in_flight; k++) {
+                size_t slot = (frame + k) % frames_in_flight;
+                if (!pass.pending[slot]) {
+                    continue;
+                }
+                GLint available = 0;
+                glGetQueryObjectiv(pass.queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+                if (!available) {
+                    break;
+                }
+                GLuint64 ns = 0;
+                glGetQueryObjectui64v(pass.queries[slot], GL_QUERY_RESULT, &ns);
+                pass.pending[slot] = false;
+                add_sample(pass, pass.query_frames[slot], ns);
+            }
+        }
+        frame++;
+    }
+
+    // Latest measured time of the pass, 0 before the first result.
+    float get_ms(const std::string& name) {
+        for (auto& pass : passes) {
+            if (pass.name == name) {
+                return pass.history.empty() ? 0 : pass.history.back().ms;
+            }
+        }
+        return 0;
+    }
+
+    // Mean of the times of the pass measured since reset_means(), 0 before the first result.
+    double get_mean_ms(const std::string& name) {
+        for (auto& pass : passes) {
+            if (pass.name == name) {
+                return pass.samples_count == 0 ? 0 : pass.total_ms / pass.samples_count;
+            }
+        }
+        return 0;
+    }
+
+    void reset_means() {
+        for (auto& pass : passes) {
+            pass.total_ms = 0;
+            pass.samples_count = 0;
+        }
+    }
+
+    // The last history_size times of the pass, oldest first.
+    const std::vector<float>& get_history(const std::string& name) {
+        static const std::vector<float> empty;
+        for (auto& pass : passes) {
+            if (pass.name == name) {
+                return pass.history_ms;
+            }
+        }
+        return empty;
+    }
+
+    // Every sample kept, as "frame,pass,ms" lines.
+    void export_csv(const std::string& path) {
+        std::ofstream file(path);
+        if (!file) {
+            throw std::runtime_error("can't write " + path);
+        }
+        file << "frame,pass,ms\n";
+        for (auto& pass : passes) {
+            for (const Sample& s : pass.history) {
+                file << s.frame << "," << pass.name << "," << s.ms << "\n";
+            }
+        }
+    }
+};
@@ -0,0 +1,277 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <glm/glm.hpp>
+#include "textures.h"
+
+
+// Single channel height grid in [0, 1], stored as 8-bit (uint8_t) or 16-bit
+// (uint16_t) values, with an optional min/max pyramid for range queries.
+// Sample coordinates are in texels: texel (x, y) covers [x, x + 1) x [y, y + 1)
+// and its centre is at (x + 0.5, y + 0.5), as for GL textures; outside the grid
+// the edge texels repeat.
+template<class T>
+class HeightField {
+
+    private:
+
+    static constexpr T max_value = std::numeric_limits<T>::max();
+
+    struct Level {
+        int width;
+        int height;
+        std::vector<T> min;
+        std::vector<T> max;
+    };
+
+    int width = 0;
+    int height = 0;
+    std::vector<T> values;
+
+    // Level L holds the min and max of 2^L x 2^L texel blocks, level 0 is empty
+    // because it would repeat values. Without the pyramid there is only level 0
+    // and range queries visit every texel.
+    std::vector<Level> levels;
+
+    T get_value(int x, int y) const {
+        x = std::clamp(x, 0, width - 1);
+        y = std::clamp(y, 0, height - 1);
+        return values[y * width + x];
+    }
+
+    void build_levels(bool with_pyramid) {
+        levels.assign(1, Level { width, height, {}, {} });
+
+        while (with_pyramid && (levels.back().width > 1 || levels.back().height > 1)) {
+            const Level& fine = levels.back();
+            Level coarse { (fine.width + 1) / 2, (fine.height + 1) / 2, {}, {} };
+            coarse.min.resize(coarse.width * coarse.height);
+            coarse.max.resize(coarse.width * coarse.height);
+
+            for (int y = 0; y < coarse.height; y++) {
+                for (int x = 0; x < coarse.width; x++) {
+                    T lo = max_value;
+                    T hi = 0;
+
+                    for (int k = 0; k < 4; k++) {
+                        int fx = std::min(2 * x + k % 2, fine.width - 1);
+                        int fy = std::min(2 * y + k / 2, fine.height - 1);
+                        size_t index = fy * fine.width + fx;
+                        lo = std::min(lo, levels.size() == 1 ? values[index] : fine.min[index]);
+                        hi = std::max(hi, levels.size() == 1 ? values[index] : fine.max[index]);
+                    }
+
+                    coarse.min[y * coarse.width + x] = lo;
+                    coarse.max[y * coarse.width + x] = hi;
+                }
+            }
+
+            levels.push_back(std::move(coarse));
+        }
+    }
+
+    // Catmull-Rom weights of the four taps around t in [0, 1), and their derivatives.
+    static void get_cubic_weights(float t, float* w, float* d) {
+        float t2 = t * t;
+        float t3 = t2 * t;
+        w[0] = (-t3 + 2 * t2 - t) / 2;
+        w[1] = (3 * t3 - 5 * t2 + 2) / 2;
+        w[2] = (-3 * t3 + 4 * t2 + t) / 2;
+        w[3] = (t3 - t2) / 2;
+        d[0] = (-3 * t2 + 4 * t - 1) / 2;
+        d[1] = (9 * t2 - 10 * t) / 2;
+        d[2] = (-9 * t2 + 8 * t + 1) / 2;
+        d[3] = (3 * t2 - 2 * t) / 2;
+    }
+
+    // Calls f(min, max) for the pyramid blocks covering the texels sampled in [x0, x1] x [y0, y1].
+    template<class F>
+    void for_each_block(float x0, float y0, float x1, float y1, F&& f) const {
+        int tx0 = std::clamp((int) std::floor(std::min(x0, x1) - 0.5f), 0, width - 1);
+        int ty0 = std::clamp((int) std::floor(std::min(y0, y1) - 0.5f), 0, height - 1);
+        int tx1 = std::clamp((int) std::floor(std::max(x0, x1) - 0.5f) + 1, 0, width - 1);
+        int ty1 = std::clamp((int) std::floor(std::max(y0, y1) - 0.5f) + 1, 0, height - 1);
+        for_each_texel_block(tx0, ty0, tx1, ty1, f);
+    }
+
+    // The same for the texels [tx0, tx1] x [ty0, ty1], which must be in the grid.
+    template<class F>
+    void for_each_texel_block(int tx0, int ty0, int tx1, int ty1, F&& f) const {
+        size_t level = 0;
+        while (level + 1 < levels.size() && ((std::max(tx1 - tx0, ty1 - ty0) + 1) >> level) > 4) {
+            level++;
+        }
+
+        for (int y = ty0 >> level; y <= ty1 >> level; y++) {
+            for (int x = tx0 >> level; x <= tx1 >> level; x++) {
+                if (level == 0) {
+                    T v = values[y * width + x];
+                    f(v, v);
+                } else {
+                    const Level& l = levels[level];
+                    f(l.min[y * l.width + x], l.max[y * l.width + x]);
+                }
+            }
+        }
+    }
+
+    public:
+
+    HeightField(int width, int height, std::vector<T> values, bool with_pyramid = true)
+      : width(width)
+      , height(height)
+      , values(std::move(values))
+    {
+        build_levels(with_pyramid);
+    }
+
+    // Heights are taken from the red channel of an image, read with 8 or 16 bits
+    // per channel to match T.
+    HeightField(const std::string& file, bool with_pyramid = true) {
+        int channels = 0;
+        T* data = nullptr;
+        if constexpr (sizeof(T) == 1) {
+            data = stbi_load(file.c_str(), &width, &height, &channels, STBI_rgb);
+        } else {
+            data = stbi_load_16(file.c_str(), &width, &height, &channels, STBI_rgb);
+        }
+        if (!data) {
+            throw std::runtime_error("error in loading height map");
+        }
+
+        values.resize(width * height);
+        for (size_t k = 0; k < values.size(); k++) {
+            values[k] = data[3 * k];
+        }
+        stbi_image_free(data);
+
+        build_levels(with_pyramid);
+    }
+
+    int get_width() const {
+        return width;
+    }
+
+    int get_height() const {
+        return height;
+    }
+
+    const T* data() const {
+        return values.data();
+    }
+
+    // Bytes held by the values and the pyramid.
+    size_t get_memory_size() const {
+        size_t result = values.size() * sizeof(T);
+        for (const Level& level : levels) {
+            result += (level.min.size() + level.max.size()) * sizeof(T);
+        }
+        return result;
+    }
+
+    float get(int x, int y) const {
+        return get_value(x, y) / (float) max_value;
+    }
+
+    float sample_nearest(float x, float y) const {
+        return get((int) std::floor(x), (int) std::floor(y));
+    }
+
+    float sample_bilinear(float x, float y) const {
+        float fx = x - 0.5f;
+        float fy = y - 0.5f;
+        int ix = (int) std::floor(fx);
+        int iy = (int) std::floor(fy);
+        float tx = fx - ix;
+        float ty = fy - iy;
+
+        float top = get(ix, iy) * (1 - tx) + get(ix + 1, iy) * tx;
+        float bottom = get(ix, iy + 1) * (1 - tx) + get(ix + 1, iy + 1) * tx;
+        return top * (1 - ty) + bottom * ty;
+    }
+
+    // Bicubic height and its d/dx, d/dy per texel in one lookup.
+    glm::vec3 sample_bicubic_with_gradient(float x, float y) const {
+        float fx = x - 0.5f;
+        float fy = y - 0.5f;
+        int ix = (int) std::floor(fx);
+        int iy = (int) std::floor(fy);
+
+        float wx[4], dx[4], wy[4], dy[4];
+        get_cubic_weights(fx - ix, wx, dx);
+        get_cubic_weights(fy - iy, wy, dy);
+
+        glm::vec3 result(0);
+        for (int b = 0; b < 4; b++) {
+            float row = 0;
+            float row_dx = 0;
+            for (int a = 0; a < 4; a++) {
+                float v = get(ix - 1 + a, iy - 1 + b);
+                row += wx[a] * v;
+                row_dx += dx[a] * v;
+            }
+            result[0] += wy[b] * row;
+            result[1] += wy[b] * row_dx;
+            result[2] += dy[b] * row;
+        }
+        return result;
+    }
+
+    // Catmull-Rom: passes through the texel centres and has a continuous gradient.
+    float sample_bicubic(float x, float y) const {
+        return sample_bicubic_with_gradient(x, y)[0];
+    }
+
+    // d/dx and d/dy of the bicubic surface, per texel.
+    glm::vec2 get_gradient(float x, float y) const {
+        glm::vec3 s = sample_bicubic_with_gradient(x, y);
+        return glm::vec2(s[1], s[2]);
+    }
+
+    // Lowest and highest nearest or bilinear sample in [x0, x1] x [y0, y1], possibly
+    // a little wider: the rectangle is covered by at most 4 x 4 blocks of a pyramid level.
+    glm::vec2 get_range(float x0, float y0, float x1, float y1) const {
+        T lo = max_value;
+        T hi = 0;
+        for_each_block(x0, y0, x1, y1, [&lo, &hi](T block_min, T block_max) {
+            lo = std::min(lo, block_min);
+            hi = std::max(hi, block_max);
+        });
+        return glm::vec2(lo / (float) max_value, hi / (float) max_value);
+    }
+
+    // Just the highest value of get_range.
+    float get_max(float x0, float y0, float x1, float y1) const {
+        T hi = 0;
+        for_each_block(x0, y0, x1, y1, [&hi](T, T block_max) {
+            hi = std::max(hi, block_max);
+        });
+        return hi / (float) max_value;
+    }
+
+    // Lowest and highest value of the texels [x0, x1] x [y0, y1], possibly a little wider.
+    glm::vec2 get_texel_range(int x0, int y0, int x1, int y1) const {
+        T lo = max_value;
+        T hi = 0;
+        for_each_texel_block(x0, y0, x1, y1, [&lo, &hi](T block_min, T block_max) {
+            lo = std::min(lo, block_min);
+            hi = std::max(hi, block_max);
+        });
+        return glm::vec2(lo / (float) max_value, hi / (float) max_value);
+    }
+
+    // Highest value of the texels [x0, x1] x [y0, y1], possibly a little higher.
+    float get_texel_max(int x0, int y0, int x1, int y1) const {
+        T hi = 0;
+        for_each_texel_block(x0, y0, x1, y1, [&hi](T, T block_max) {
+            hi = std::max(hi, block_max);
+        });
+        return hi / (float) max_value;
+    }
+};
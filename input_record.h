@@ -0,0 +1,233 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+#include <stdexcept>
+#include "map.h"
+
+
+// The settings of the UI in a frame.
+struct InputSettings {
+    int zoom_sensitivity;
+    float detail_coef;
+    int detail_repeat_count;
+    float detail_dist;
+    int tex1_repeat_count;
+    int tex2_repeat_count;
+    int tex3_repeat_count;
+    float spring_coef;
+    int enable;
+    float shadow_distance;
+    bool cache_static_shadows;
+    float torus_R;
+    float torus_r;
+    int torus_x_count;
+    int torus_y_count;
+    bool torus_procedural;
+    bool vertex_cache_order;
+    bool enable_lod;
+    float lod_distance;
+    int vehicles_count;
+};
+
+
+// One rendered frame: the time since the previous frame and the controls read in it.
+struct InputFrame {
+    uint32_t delta_ns;
+    Map::Input input;
+    InputSettings settings;
+};
+
+
+// Input log format: "TEIR", version and simulation tick in nanoseconds (uint32 each),
+// then per frame a varint time delta and a byte with the speed and turn signs in two
+// bits each; bit 4 of that byte is set when the torus grid changed, and the new grid
+// size follows as two varints; bit 5 is set when the settings changed, and all of
+// them follow, in the order of InputSettings, as 4 bytes each or a byte for flags.
+class InputRecord {
+
+    private:
+
+    InputRecord() { }
+
+    public:
+
+    static constexpr char magic[4] = { 'T', 'E', 'I', 'R' };
+    static constexpr uint32_t version = 3;
+
+    static uint8_t pack_sign(float v) {
+        return v > 0 ? 1 : v < 0 ? 2 : 0;
+    }
+
+    static float unpack_sign(uint8_t bits) {
+        return bits == 1 ? 1.f : bits == 2 ? -1.f : 0.f;
+    }
+
+    // Calls f on every field of the settings, in the order they are logged.
+    template <typename Settings, typename F>
+    static void for_each_setting(Settings& s, F f) {
+        f(s.zoom_sensitivity);
+        f(s.detail_coef);
+        f(s.detail_repeat_count);
+        f(s.detail_dist);
+        f(s.tex1_repeat_count);
+        f(s.tex2_repeat_count);
+        f(s.tex3_repeat_count);
+        f(s.spring_coef);
+        f(s.enable);
+        f(s.shadow_distance);
+        f(s.cache_static_shadows);
+        f(s.torus_R);
+        f(s.torus_r);
+        f(s.torus_x_count);
+        f(s.torus_y_count);
+        f(s.torus_procedural);
+        f(s.vertex_cache_order);
+        f(s.enable_lod);
+        f(s.lod_distance);
+        f(s.vehicles_count);
+    }
+};
+
+
+class InputRecorder {
+
+    private:
+
+    std::ofstream file;
+    glm::vec2 grid_size = glm::vec2(-1);
+    std::string settings;
+
+    void write_u32(uint32_t v) {
+        file.write(reinterpret_cast<const char*>(&v), sizeof(v));
+    }
+
+    void write_varint(uint32_t v) {
+        while (v >= 0x80) {
+            file.put(char(v & 0x7f | 0x80));
+            v >>= 7;
+        }
+        file.put(char(v));
+    }
+
+    public:
+
+    InputRecorder(const std::string& path, uint32_t tick_ns) : file(path, std::ios::binary) {
+        if (!file) {
+            throw std::runtime_error("error in opening input record " + path);
+        }
+        file.write(InputRecord::magic, sizeof(InputRecord::magic));
+        write_u32(InputRecord::version);
+        write_u32(tick_ns);
+    }
+
+    void record(const InputFrame& frame) {
+        const Map::Input& input = frame.input;
+        bool grid_changed = input.grid_size != grid_size;
+
+        std::string frame_settings;
+        InputRecord::for_each_setting(frame.settings, [&frame_settings](const auto& v) {
+            frame_settings.append(reinterpret_cast<const char*>(&v), sizeof(v));
+        });
+        bool settings_changed = frame_settings != settings;
+
+        write_varint(frame.delta_ns);
+        file.put(char(InputRecord::pack_sign(input.speed) | InputRecord::pack_sign(input.turn) << 2 | grid_changed << 4 | settings_changed << 5));
+        if (grid_changed) {
+            write_varint(uint32_t(input.grid_size[0]));
+            write_varint(uint32_t(input.grid_size[1]));
+            grid_size = input.grid_size;
+        }
+        if (settings_changed) {
+            file.write(frame_settings.data(), frame_settings.size());
+            settings = frame_settings;
+        }
+    }
+};
+
+
+class InputReplay {
+
+    private:
+
+    std::vector<InputFrame> frames;
+    size_t position = 0;
+    uint32_t tick_ns = 0;
+
+    public:
+
+    InputReplay(const std::string& path) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            throw std::runtime_error("error in opening input record " + path);
+        }
+
+        char header[4];
+        uint32_t file_version = 0;
+        file.read(header, sizeof(header));
+        file.read(reinterpret_cast<char*>(&file_version), sizeof(file_version));
+        file.read(reinterpret_cast<char*>(&tick_ns), sizeof(tick_ns));
+        if (!file || !std::equal(header, header + 4, InputRecord::magic) || file_version != InputRecord::version) {
+            throw std::runtime_error("not an input record: " + path);
+        }
+
+        auto read_varint = [&file]() {
+            uint32_t v = 0;
+            for (int shift = 0; shift < 35; shift += 7) {
+                int c = file.get();
+                if (c == EOF) {
+                    throw std::runtime_error("truncated input record");
+                }
+                v |= uint32_t(c & 0x7f) << shift;
+                if (!(c & 0x80)) {
+                    break;
+                }
+            }
+            return v;
+        };
+
+        InputFrame frame {};
+        while (file.peek() != EOF) {
+            frame.delta_ns = read_varint();
+            int bits = file.get();
+            if (bits == EOF) {
+                throw std::runtime_error("truncated input record");
+            }
+            frame.input.speed = InputRecord::unpack_sign(bits & 3);
+            frame.input.turn = InputRecord::unpack_sign(bits >> 2 & 3);
+            if (bits & 16) {
+                float rows = read_varint();
+                float columns = read_varint();
+                frame.input.grid_size = glm::vec2(rows, columns);
+            }
+            if (bits & 32) {
+                InputRecord::for_each_setting(frame.settings, [&file](auto& v) {
+                    file.read(reinterpret_cast<char*>(&v), sizeof(v));
+                });
+                if (!file) {
+                    throw std::runtime_error("truncated input record");
+                }
+            }
+            frames.push_back(frame);
+        }
+    }
+
+    uint32_t get_tick_ns() {
+        return tick_ns;
+    }
+
+    size_t get_frames_count() {
+        return frames.size();
+    }
+
+    // The next recorded frame, false once all were played.
+    bool next(InputFrame& frame) {
+        if (position >= frames.size()) {
+            return false;
+        }
+        frame = frames[position++];
+        return true;
+    }
+};
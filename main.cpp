@@ -24,14 +24,29 @@
 #include <glm/gtx/rotate_vector.hpp>
 #include <chrono>
 #include <unistd.h>
+#include <random>
+#include <memory>
+#include <thread>
+#include <cstring>
+#include <cfloat>
 
 #include "opengl_shader.h"
+#include "frame_uniforms.h"
 #include "environment.h"
 #include "textures.h"
 #include "object_loader.h"
 #include "torus.h"
+#include "torus_rebuild.h"
 #include "map.h"
+#include "simulation.h"
+#include "input_record.h"
 #include "shadow_map.h"
+#include "shadow_cascades.h"
+#include "shadow_cache.h"
+#include "vehicle_placement.h"
+#include "render_graph.h"
+#include "pipeline_statistics.h"
+#include "profiler.h"
 
 
 float mouse_offset_x = 0.0;
@@ -57,6 +72,13 @@ int tex3_repeat_count = 6;
 float spring_coef = 0.15;
 
 int enable = 1;
+float shadow_distance = 30;
+bool cache_static_shadows = true;
+
+bool enable_lod = true;
+float lod_distance = 4.0;
+int simulation_rate = 120;
+int vehicles_count = 1;
 
 
 static void glfw_error_callback(int error, const char *description)
@@ -64,9 +86,97 @@ static void glfw_error_callback(int error, const char *description)
    std::cerr << fmt::format("Glfw Error {}: {}\n", error, description);
 }
 
+// The settings of the UI, but the torus shape that main keeps.
+static InputSettings get_settings()
+{
+   InputSettings s {};
+   s.zoom_sensitivity = zoom_sensitivity;
+   s.detail_coef = detail_coef;
+   s.detail_repeat_count = detail_repeat_count;
+   s.detail_dist = detail_dist;
+   s.tex1_repeat_count = tex1_repeat_count;
+   s.tex2_repeat_count = tex2_repeat_count;
+   s.tex3_repeat_count = tex3_repeat_count;
+   s.spring_coef = spring_coef;
+   s.enable = enable;
+   s.shadow_distance = shadow_distance;
+   s.cache_static_shadows = cache_static_shadows;
+   s.enable_lod = enable_lod;
+   s.lod_distance = lod_distance;
+   s.vehicles_count = vehicles_count;
+   return s;
+}
+
+static void set_settings(const InputSettings& s)
+{
+   zoom_sensitivity = s.zoom_sensitivity;
+   detail_coef = s.detail_coef;
+   detail_repeat_count = s.detail_repeat_count;
+   detail_dist = s.detail_dist;
+   tex1_repeat_count = s.tex1_repeat_count;
+   tex2_repeat_count = s.tex2_repeat_count;
+   tex3_repeat_count = s.tex3_repeat_count;
+   spring_coef = s.spring_coef;
+   enable = s.enable;
+   shadow_distance = s.shadow_distance;
+   cache_static_shadows = s.cache_static_shadows;
+   enable_lod = s.enable_lod;
+   lod_distance = s.lod_distance;
+   vehicles_count = s.vehicles_count;
+}
 
-int main(int, char **)
+static Map::Input keyboard_input(Map& map)
 {
+   Map::Input input;
+   if (ImGui::IsKeyDown(GLFW_KEY_UP)) {
+      input.speed = -1.0f;
+   }
+   else if (ImGui::IsKeyDown(GLFW_KEY_DOWN)) {
+      input.speed = 1.0f;
+   }
+   if (ImGui::IsKeyDown(GLFW_KEY_RIGHT)) {
+      input.turn += 1.0f;
+   }
+   if (ImGui::IsKeyDown(GLFW_KEY_LEFT)) {
+      input.turn -= 1.0f;
+   }
+   input.grid_size = map.get_grid_size();
+   return input;
+}
+
+
+// Options: --record <file> logs the input and settings of every frame, --replay <file> plays
+// such a log back instead of the keyboard, --fast replays without waiting or presenting,
+// --trace <file> writes the profiler zones of the run as a Chrome trace on exit.
+int main(int argc, char **argv)
+{
+   std::unique_ptr<InputRecorder> recorder;
+   std::unique_ptr<InputReplay> replay;
+   std::string record_path;
+   std::string trace_path;
+   bool fast_replay = false;
+
+   for (int k = 1; k < argc; k++) {
+      if (std::strcmp(argv[k], "--record") == 0 && k + 1 < argc) {
+         record_path = argv[++k];
+      } else if (std::strcmp(argv[k], "--replay") == 0 && k + 1 < argc) {
+         replay = std::make_unique<InputReplay>(argv[++k]);
+      } else if (std::strcmp(argv[k], "--fast") == 0) {
+         fast_replay = true;
+      } else if (std::strcmp(argv[k], "--trace") == 0 && k + 1 < argc) {
+         trace_path = argv[++k];
+      } else {
+         std::cerr << fmt::format("unknown option {}\n", argv[k]);
+         return 1;
+      }
+   }
+   fast_replay &= bool(replay);
+   if (!trace_path.empty()) {
+      Profiler::start();
+      Profiler::set_thread_name("main");
+   }
+   ProfileZone startup_zone("startup");
+
    // Use GLFW to create a simple window
    glfwSetErrorCallback(glfw_error_callback);
    if (!glfwInit())
@@ -85,20 +195,29 @@ int main(int, char **)
    if (window == NULL)
       return 1;
    glfwMakeContextCurrent(window);
-   glfwSwapInterval(1); // Enable vsync
+   glfwSwapInterval(fast_replay ? 0 : 1); // Enable vsync
 
    // Initialize GLEW, i.e. fill all possible function pointers for current OpenGL context
+   ProfileZone glew_zone("glewInit");
    if (glewInit() != GLEW_OK)
    {
       std::cerr << "Failed to initialize OpenGL loader!\n";
       return 1;
    }
+   glew_zone.end();
 
 
+   ProfileZone shaders_zone("compile shaders");
    shader_t env_shader("environment.vs", "environment.fs");
    shader_t torus_shader("torus.vs", "torus.fs");
    shader_t obj_shader("obj.vs", "obj.fs");
    shader_t shadow_shader("shadow.vs", "shadow.fs");
+   shaders_zone.end();
+
+   FrameUniforms frame_uniforms;
+   frame_uniforms.attach(env_shader);
+   frame_uniforms.attach(torus_shader);
+   frame_uniforms.attach(obj_shader);
 
    std::array<std::string, 6> env_textures = {
       "../environment/space1.jpg",
@@ -109,13 +228,18 @@ int main(int, char **)
       "../environment/space1.jpg"
    };
 
+   ProfileZone textures_zone("load textures");
    GLuint cubemap_texture = CubemapTextureLoader::load(env_textures);
    GLuint obj_textute = TextureLoader::load("../objects/Lexus.jpg");
+   textures_zone.end();
 
+   ProfileZone object_zone("load object");
    Object obj = ObjLoader::load("../objects/", "../objects/lexus_hs.obj");
+   object_zone.end();
 
    Environment env;
 
+   ProfileZone torus_textures_zone("load torus textures");
    std::array<Texture, 3> torus_textures = {
       Texture("../textures/tex8.jpg"),
       Texture("../textures/tex10.jpg"),
@@ -127,8 +251,10 @@ int main(int, char **)
       Texture("../textures/detail1.jpg"),
       Texture("../textures/detail1.jpg"),
    };
+   torus_textures_zone.end();
 
 
+   ProfileZone torus_zone("build torus");
    Torus torus(
       10,
       2,
@@ -136,10 +262,33 @@ int main(int, char **)
       torus_textures,
       detail_textures
    );
-
-   Shadow_map near_shadow_map;
-   Shadow_map far_shadow_map;
-   Shadow_map object_shadow_map;
+   torus_zone.end();
+
+   TorusRebuild torus_rebuild(torus);
+   float torus_R = torus.get_R();
+   float torus_r = torus.get_r();
+   int torus_x_count = torus.get_x_count();
+   int torus_y_count = torus.get_y_count();
+   bool torus_procedural = torus.is_procedural();
+   bool vertex_cache_order = torus.get_vertex_cache_order();
+
+   // The settings of the last frame, with the torus shape last requested.
+   InputSettings settings = get_settings();
+   settings.torus_R = torus_R;
+   settings.torus_r = torus_r;
+   settings.torus_x_count = torus_x_count;
+   settings.torus_y_count = torus_y_count;
+   settings.torus_procedural = torus_procedural;
+   settings.vertex_cache_order = vertex_cache_order;
+
+   RenderGraph render_graph;
+
+   // The shadow cascades, then the torus and the vehicles.
+   ShadowCascades shadow_cascades;
+   ShadowCache shadow_cache;
+   // Bound to the shadow sampler instead of the cascades when shadows are off.
+   Shadow_map no_shadows(1, 1);
+   PipelineStatistics vertex_statistics(ShadowCascades::count + 2);
 
 
    // Setup GUI context
@@ -157,12 +306,45 @@ int main(int, char **)
    float a1, a2, a3, a4, a5, a6;
    a1 = a2 = a3 = a4 = a5 = a6 = 0.2;
 
-   Map map(torus, std::chrono::high_resolution_clock::now());
+   Map map(torus);
+   auto start_time = std::chrono::steady_clock::now();
+   auto prev_frame_time = start_time;
+
+   // Replays and recordings run the simulation ticks themselves, on the frame times.
+   InputFrame replay_frame;
+   std::chrono::nanoseconds tick(1000000000 / simulation_rate);
+   if (replay) {
+      tick = std::chrono::nanoseconds(replay->get_tick_ns());
+      simulation_rate = 1000000000 / tick.count();
+   }
+   if (!record_path.empty()) {
+      recorder = std::make_unique<InputRecorder>(record_path, tick.count());
+   }
+   Simulation simulation(map.get_state(), tick, !replay && !recorder, start_time);
+   size_t frames_count = 0;
+
+   // The other vehicles stand still: place on the grid as a fraction of its size, and heading.
+   // Their matrices only change with the torus shape.
+   std::vector<glm::vec3> parked_vehicles;
+   std::vector<glm::mat4> vehicle_models;
+   size_t parked_shape_version = torus.get_shape_version();
+   std::mt19937 vehicles_random(1);
    glm::vec3 camera_pos = {100, 100, 100};
 
+   // GL binding calls of the last frame, made and skipped as redundant.
+   size_t state_calls = 0;
+   size_t state_skipped = 0;
+   startup_zone.end();
+
    while (!glfwWindowShouldClose(window))
    {
       glfwPollEvents();
+      vertex_statistics.collect();
+
+      if (replay && !replay->next(replay_frame)) {
+         break;
+      }
+      frames_count++;
 
       // Get windows size
       int display_w, display_h;
@@ -191,165 +373,309 @@ int main(int, char **)
       ImGui::SliderInt("tex3_repeat_count", &tex3_repeat_count, 1, 100);
       ImGui::SliderFloat("spring_coef", &spring_coef, 0.05f, 1.f);
       ImGui::InputInt("enable", &enable);
+      ImGui::SliderFloat("shadow distance", &shadow_distance, 5.f, 100.f);
+      ImGui::Checkbox("cache static shadows", &cache_static_shadows);
+
+      bool torus_changed = false;
+      ImGui::SliderFloat("torus R", &torus_R, 4.f, 30.f);
+      torus_changed |= ImGui::IsItemDeactivatedAfterEdit();
+      ImGui::SliderFloat("torus r", &torus_r, 0.5f, 5.f);
+      torus_changed |= ImGui::IsItemDeactivatedAfterEdit();
+      ImGui::SliderInt("torus x_count", &torus_x_count, 16, 1000);
+      torus_changed |= ImGui::IsItemDeactivatedAfterEdit();
+      ImGui::SliderInt("torus y_count", &torus_y_count, 16, 5000);
+      torus_changed |= ImGui::IsItemDeactivatedAfterEdit();
+      torus_changed |= ImGui::Checkbox("procedural torus", &torus_procedural);
+      torus_changed |= ImGui::Checkbox("vertex cache order", &vertex_cache_order);
+      ImGui::Checkbox("lod", &enable_lod);
+      ImGui::SliderFloat("lod_distance", &lod_distance, 1.f, 20.f);
+      if (!replay && !recorder && ImGui::SliderInt("simulation rate, Hz", &simulation_rate, 10, 1000)) {
+         simulation.set_tick(std::chrono::nanoseconds(1000000000 / simulation_rate));
+      }
+      ImGui::SliderInt("vehicles", &vehicles_count, 1, 10000);
+      ImGui::Text("torus triangles: %d", (int) torus.get_drawn_triangles());
+      ImGui::Text("vehicles drawn: %d", (int) obj.get_visible_count());
+      ImGui::Text("torus ACMR: %.3f -> %.3f", torus.get_acmr()[0], torus.get_acmr()[1]);
+      ImGui::Text("object ACMR: %.3f -> %.3f", obj.get_acmr()[0], obj.get_acmr()[1]);
+      ImGui::Text("state changes: %d, skipped: %d", (int) state_calls, (int) state_skipped);
+      if (vertex_statistics.is_supported()) {
+         std::string invocations;
+         for (size_t k = 0; k < ShadowCascades::count + 2; k++) {
+            invocations += fmt::format("{}{}", k > 0 ? " / " : "", vertex_statistics.get_invocations(k));
+         }
+         ImGui::Text("vertex shader invocations: %s", invocations.c_str());
+      }
+      ImGui::Text("depth targets: %d", (int) render_graph.get_depth_targets_count());
+      ImGui::Text("static shadow renders: %d", (int) shadow_cache.get_renders_count());
+      if (torus_rebuild.is_busy()) {
+         ImGui::Text("rebuilding torus...");
+      }
       ImGui::End();
 
+      ImGui::Begin("Passes");
+      GpuTimers& gpu_timers = render_graph.get_timers();
+      for (auto& pass : render_graph.get_stats()) {
+         if (pass.culled) {
+            ImGui::Text("%s: culled", pass.name.c_str());
+            continue;
+         }
+         ImGui::Text("%s: CPU %.3f ms, GPU %.3f ms", pass.name.c_str(), pass.cpu_ms, pass.gpu_ms);
+         const std::vector<float>& history = gpu_timers.get_history(pass.name);
+         if (!history.empty()) {
+            ImGui::PlotHistogram(("##" + pass.name).c_str(), history.data(), history.size(), 0, nullptr, 0.f, FLT_MAX, ImVec2(0, 40));
+         }
+      }
+      if (!gpu_timers.is_supported()) {
+         ImGui::Text("GPU timers are not supported");
+      } else if (ImGui::Button("export GPU times")) {
+         gpu_timers.export_csv("gpu_times.csv");
+      }
+      ImGui::End();
+
+      // A replay takes the recorded settings; the torus shape is requested on the
+      // frame its slider was released.
+      if (replay) {
+         const InputSettings& recorded = replay_frame.settings;
+         torus_changed = recorded.torus_R != settings.torus_R || recorded.torus_r != settings.torus_r ||
+                         recorded.torus_x_count != settings.torus_x_count || recorded.torus_y_count != settings.torus_y_count ||
+                         recorded.torus_procedural != settings.torus_procedural ||
+                         recorded.vertex_cache_order != settings.vertex_cache_order;
+         settings = recorded;
+         set_settings(settings);
+         torus_R = settings.torus_R;
+         torus_r = settings.torus_r;
+         torus_x_count = settings.torus_x_count;
+         torus_y_count = settings.torus_y_count;
+         torus_procedural = settings.torus_procedural;
+         vertex_cache_order = settings.vertex_cache_order;
+      } else {
+         InputSettings previous = settings;
+         settings = get_settings();
+         settings.torus_R = torus_changed ? torus_R : previous.torus_R;
+         settings.torus_r = torus_changed ? torus_r : previous.torus_r;
+         settings.torus_x_count = torus_changed ? torus_x_count : previous.torus_x_count;
+         settings.torus_y_count = torus_changed ? torus_y_count : previous.torus_y_count;
+         settings.torus_procedural = torus_changed ? torus_procedural : previous.torus_procedural;
+         settings.vertex_cache_order = torus_changed ? vertex_cache_order : previous.vertex_cache_order;
+      }
+
+      if (torus_changed) {
+         torus_rebuild.request(settings.torus_R, settings.torus_r, settings.torus_x_count, settings.torus_y_count, settings.torus_procedural, settings.vertex_cache_order);
+      }
+      obj.set_vertex_cache_order(settings.vertex_cache_order);
+      torus_rebuild.update();
+
         
-      map.buttons_callback();
-      int d_time = map.move(std::chrono::high_resolution_clock::now());
+      Map::Input input = keyboard_input(map);
+      auto frame_time = std::chrono::steady_clock::now();
+      if (replay) {
+         input = replay_frame.input;
+         frame_time = prev_frame_time + std::chrono::nanoseconds(replay_frame.delta_ns);
+         if (!fast_replay) {
+            std::this_thread::sleep_until(frame_time);
+         }
+      }
+      int d_time = std::chrono::duration_cast<std::chrono::nanoseconds>(frame_time - prev_frame_time).count();
+      prev_frame_time = frame_time;
+
+      if (recorder) {
+         recorder->record({ uint32_t(d_time), input, settings });
+      }
+      simulation.set_input(input);
+      if (replay || recorder) {
+         simulation.advance(frame_time);
+      }
+      map.set_state(simulation.get_state(frame_time));
 
      
+      ProfileZone matrices_zone("frame matrices");
       glm::mat4 projection = glm::perspective<float>(90, float(display_w) / display_h, 0.1, 100);
       auto model_torus = torus.get_model_matrix();
 
 
-      auto pos = map.get_point_on_torus();
       auto dir = map.get_direction_on_torus();
+      SurfaceSample surface_sample = map.get_surface_sample();
+      glm::mat4 placement = model_torus * surface_sample.placement;
    
-      auto model_obj = obj.get_model_matrix();
-
-      glm::vec3 bottom_center = glm::vec3(model_obj * glm::vec4(obj.get_bottom_center(), 1));
-      glm::vec3 torus_point = glm::vec3(model_torus * glm::vec4(torus.get_vertex(pos[0], pos[1]), 1));
-      glm::vec3 torus_normal = glm::vec3(model_torus * glm::vec4(torus.get_normal(pos[0], pos[1]), 1));
-
-      auto to_normal = glm::orientation(torus_normal, glm::vec3(1, 0, 0));
-      glm::vec3 new_y = normalize(glm::vec3(to_normal * glm::vec4(0, 1, 0, 0)));
-      glm::vec3 new_x = normalize(glm::vec3(to_normal * glm::vec4(1, 0, 0, 0)));
-      glm::vec3 new_z = normalize(glm::vec3(to_normal * glm::vec4(0, 0, 1, 0)));
-      glm::vec3 torus_dir_x = normalize(map.get_torus_dir_x());
-      glm::vec3 torus_dir_y = normalize(map.get_torus_dir_y());
-      glm::vec3 torus_dir = normalize(map.get_torus_dir());
-
-      auto alpha = acos(dot(new_y, torus_dir_x));
-      auto beta = acos(dot(new_z, torus_dir_x));
-      if (dot(new_z, torus_dir_y) > 0) {
-          beta = -beta;
+      if (enable_lod) {
+         torus.select_lod(surface_sample.position, lod_distance);
+      } else {
+         torus.reset_lod();
+      }
+
+      auto model_obj = place_vehicle(obj, model_torus, surface_sample, map.get_angle());
+
+      std::uniform_real_distribution<float> uniform(0, 1);
+      while (parked_vehicles.size() + 1 < (size_t) vehicles_count) {
+         parked_vehicles.emplace_back(uniform(vehicles_random), uniform(vehicles_random), 2 * 3.14f * uniform(vehicles_random));
       }
 
-      auto rot1 = glm::rotate(beta, new_x);
-      auto rot2 = glm::rotate(map.get_angle() + 3.14f / 2.f, new_x);
-      model_obj = glm::translate(torus_point - bottom_center) * rot2 * rot1 * to_normal * model_obj;
+      if (vehicle_models.size() != (size_t) vehicles_count || parked_shape_version != torus.get_shape_version()) {
+         size_t placed = parked_shape_version == torus.get_shape_version() ? vehicle_models.size() : 1;
+         parked_shape_version = torus.get_shape_version();
+
+         glm::vec2 grid_size = map.get_grid_size();
+         vehicle_models.resize(vehicles_count);
+         parallel_for(std::max<size_t>(placed, 1), vehicle_models.size(), [&](size_t from, size_t to) {
+            std::vector<glm::vec2> points;
+            for (size_t k = from; k < to; k++) {
+               const glm::vec3& parked = parked_vehicles[k - 1];
+               points.push_back(glm::vec2(parked.x, parked.y) * (grid_size - 1.f));
+            }
+            std::vector<SurfaceSample> samples(points.size());
+            torus.sample(points.data(), points.size(), samples.data());
+            for (size_t k = from; k < to; k++) {
+               vehicle_models[k] = place_vehicle(obj, model_torus, samples[k - from], parked_vehicles[k - 1].z);
+            }
+         });
+         obj.set_instances(vehicle_models);
+      }
+      obj.set_instance(0, model_obj);
+      obj.begin_instances();
 
 
-      auto model_camera = torus.get_translation_matrix(pos, obj) * 
+      auto model_camera = placement * 
                           map.get_rotation_matrix() * 
                           obj.get_model_matrix();
 
-      glm::vec3 next_camera_pos = glm::vec3(torus.get_translation_matrix(pos, obj) * glm::vec4(0.7, dir.x / 2.f, dir.y / 2.f, 1));
+      glm::vec3 next_camera_pos = glm::vec3(placement * glm::vec4(0.7, dir.x / 2.f, dir.y / 2.f, 1));
 
       float distanse = glm::distance(camera_pos, next_camera_pos);
       glm::vec3 shift = glm::normalize(next_camera_pos - camera_pos) * distanse * (spring_coef / map.get_time_delta() * d_time);
       camera_pos = distanse < 0.07f ? camera_pos : camera_pos + shift;
       if (distanse > 5) { camera_pos = next_camera_pos; }
+
+      // Pulls the camera in front of terrain between it and the vehicle.
+      glm::vec3 eye = glm::vec3(glm::inverse(model_torus) * glm::vec4(camera_pos, 1));
+      glm::vec3 focus = glm::vec3(surface_sample.placement * glm::vec4(0.1, 0, 0, 1));
+      float eye_distance = glm::distance(eye, focus);
+      TorusHit occluder = torus.cast_ray({ focus, eye - focus, eye_distance });
+      glm::vec3 view_pos = camera_pos;
+      if ((occluder.hit || !occluder.resolved) && eye_distance > 0) {
+         float t = std::max(occluder.distance - 0.05f, 0.f) / eye_distance;
+         view_pos = glm::vec3(model_torus * glm::vec4(glm::mix(focus, eye, t), 1));
+      }
       
       auto view = glm::lookAt(
-         camera_pos,
-         glm::vec3(torus.get_translation_matrix(pos, obj) * glm::vec4(0, 0, 0, 1)),
+         view_pos,
+         glm::vec3(placement[3]),
          glm::vec3(model_camera * glm::vec4(-1, 0, 0, 0))
       );
 
 
 
 
-      auto light_near_projection = glm::ortho(-2.f, 2.f, -2.f, 2.f, 0.001f, 2.f);
-      auto light_near_view = glm::lookAt(
-         glm::vec3(torus.get_translation_matrix(pos, obj) * glm::vec4(0, 0, 0, 1)) + glm::vec3(0, 0, 1),
-         glm::vec3(torus.get_translation_matrix(pos, obj) * glm::vec4(0, 0, 0, 1)),
-         glm::vec3(0, 1, 0)
-      );
-      auto light_object_view = glm::lookAt(
-         glm::vec3(model_obj * glm::vec4(0.001, 0, 20.f, 1)),
-         glm::vec3(model_obj * glm::vec4(0, 0, 20.f, 1)),
-         glm::vec3(model_obj * glm::vec4(-1, 0, 0, 0))
-      );
-
-      glm::mat4 light_far_projection = glm::ortho(-15.f, 15.f, -15.f, 15.f, 0.001f, 15.f);
-      glm::mat4 light_far_view = glm::lookAt(glm::vec3(0, 0, 10), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
-      glm::mat4 light_object_projection = glm::perspective(glm::radians(90.f), 1.f, 0.001f, 1.f);
-      
-      auto vp_near = light_near_projection * light_near_view;
-      auto vp_far = light_far_projection * light_far_view;
-      auto vp_object = light_object_projection * light_object_view;;
-
-      auto torus_mvp = vp_near * model_torus;
-      auto object_mvp = vp_near * model_obj;
-      near_shadow_map.render(shadow_shader, torus, obj, torus_mvp, object_mvp);
-      torus_mvp = vp_far * model_torus;
-      object_mvp = vp_far * model_obj;
-      far_shadow_map.render(shadow_shader, torus, obj, torus_mvp, object_mvp);
-      torus_mvp = vp_object * model_torus;
-      object_mvp = vp_object * model_obj;
-      object_shadow_map.render(shadow_shader, torus, obj, torus_mvp, object_mvp);
-
-
-
-     
-      glViewport(0, 0, display_w, display_h);
-      glClear(unsigned(GL_COLOR_BUFFER_BIT) | unsigned(GL_DEPTH_BUFFER_BIT));
-
-
-      // отключаем тест глубины, чтобы все рисовалось поверх environment
-      glDepthMask(GL_FALSE);
-
-      // рисуем окружение
-
-      env_shader.use();
-      env_shader.set_uniform("projection", glm::value_ptr(projection));
-      env_shader.set_uniform("view", glm::value_ptr(view));
-      env_shader.set_uniform("environment", 1);
-
-      env.render(env_shader, cubemap_texture);
-
-      glDepthMask(GL_TRUE);
-
-
-      // рисуем тор
-      
-      torus_shader.use();
-      torus_shader.set_uniform("model", glm::value_ptr(model_torus));
-      torus_shader.set_uniform("view", glm::value_ptr(view));
-      torus_shader.set_uniform("projection", glm::value_ptr(projection));
-      torus_shader.set_uniform("detail_coef", detail_coef);
-      torus_shader.set_uniform("detail_repeat_count", detail_repeat_count);
-      torus_shader.set_uniform("detail_dist", detail_dist);
-      torus_shader.set_uniform("tex1_repeat_count", tex1_repeat_count);
-      torus_shader.set_uniform("tex2_repeat_count", tex2_repeat_count);
-      torus_shader.set_uniform("tex3_repeat_count", tex3_repeat_count);
-      torus_shader.set_uniform("near_shadow_map", (int) near_shadow_map.get_id());
-      torus_shader.set_uniform("far_shadow_map", (int) far_shadow_map.get_id());
-      torus_shader.set_uniform("object_shadow_map", (int) object_shadow_map.get_id());
-      torus_shader.set_uniform("mvp_near", glm::value_ptr(vp_near));
-      torus_shader.set_uniform("mvp_far", glm::value_ptr(vp_far));
-      torus_shader.set_uniform("mvp_object", glm::value_ptr(vp_object));
-      torus_shader.set_uniform("enable", enable);
-
-      torus.render(torus_shader);
-
-
-      // рисуем объект
-
-      obj_shader.use();
-      obj_shader.set_uniform("model", glm::value_ptr(model_obj));
-      obj_shader.set_uniform("view", glm::value_ptr(view));
-      obj_shader.set_uniform("projection", glm::value_ptr(projection));
-      obj_shader.set_uniform("obj_texture", 0);
-      obj_shader.set_uniform("cubemap_texture", 1);
-      obj_shader.set_uniform("near_shadow_map", (int) near_shadow_map.get_id());
-      obj_shader.set_uniform("mvp_near", glm::value_ptr(vp_near));
-   
-      obj.render(obj_shader, obj_textute, cubemap_texture);
-
+      // Cached, the last cascade holds the whole torus from a frustum that stays put.
+      if (cache_static_shadows) {
+         shadow_cascades.set_static_bounds(glm::vec3(model_torus[3]), torus.get_bounding_radius());
+      } else {
+         shadow_cascades.reset_static_bounds();
+      }
+      // Sunlight comes from +z; 20 covers the torus thickness along it, so every caster is drawn.
+      shadow_cascades.update(view, projection, glm::vec3(0, 0, 1), shadow_distance, 20.f, Shadow_map::size);
+
+      frame_uniforms.update(view, projection, shadow_cascades.get_matrices(), shadow_cascades.get_splits());
+      matrices_zone.end();
+
+      render_graph.reset();
+      auto backbuffer = render_graph.import_backbuffer("backbuffer", display_w, display_h);
+      auto cascades = render_graph.create_depth_target("shadow cascades", ShadowCascades::count);
+
+      // A pass per cascade, each drawing what its own light frustum holds. Without
+      // shadows (enable != 1) nothing reads the cascades and the graph culls these
+      // passes; the sampler then gets no_shadows, as a texture of another type on
+      // its unit would be invalid.
+      for (int k = 0; k < ShadowCascades::count; k++) {
+         bool cached = cache_static_shadows && k == ShadowCascades::count - 1;
+         render_graph.add_pass(fmt::format("shadow cascade {}", k), {}, { cascades }, [&, k, cached]() {
+            glm::mat4 vp = shadow_cascades.get_matrices()[k];
+            Shadow_map& shadow = render_graph.get_depth_target(cascades);
+            vertex_statistics.begin(k);
+            if (cached) {
+               shadow_cache.update(shadow_shader, torus, model_torus, vp);
+               shadow_cache.copy_to(shadow, k);
+               shadow.render(shadow_shader, obj, vp);
+            } else {
+               shadow.bind_layer(k);
+               shadow.render(shadow_shader, torus, obj, vp * model_torus, vp);
+            }
+            vertex_statistics.end();
+         });
+      }
 
-      glBindVertexArray(0);
+      std::vector<RenderGraph::Resource> shadow_reads;
+      if (enable == 1) {
+         shadow_reads = { cascades };
+      }
+      auto bind_shadows = [&]() {
+         return enable == 1 ? render_graph.get_depth_target(cascades).bind() : no_shadows.bind();
+      };
+
+      render_graph.add_pass("environment", {}, { backbuffer }, [&]() {
+         // отключаем тест глубины, чтобы все рисовалось поверх environment
+         glDepthMask(GL_FALSE);
+         env.render(env_shader, cubemap_texture);
+         glDepthMask(GL_TRUE);
+      });
+
+      render_graph.add_pass("torus", shadow_reads, { backbuffer }, [&]() {
+         torus_shader.use();
+         torus_shader.set_uniform("model", glm::value_ptr(model_torus));
+         torus_shader.set_uniform("detail_coef", detail_coef);
+         torus_shader.set_uniform("detail_repeat_count", detail_repeat_count);
+         torus_shader.set_uniform("detail_dist", detail_dist);
+         torus_shader.set_uniform("tex1_repeat_count", tex1_repeat_count);
+         torus_shader.set_uniform("tex2_repeat_count", tex2_repeat_count);
+         torus_shader.set_uniform("tex3_repeat_count", tex3_repeat_count);
+         torus_shader.set_uniform("shadow_cascades", bind_shadows());
+         torus_shader.set_uniform("enable", enable);
+
+         vertex_statistics.begin(ShadowCascades::count);
+         torus.render(torus_shader, projection * view * model_torus);
+         vertex_statistics.end();
+      });
+
+      render_graph.add_pass("vehicles", shadow_reads, { backbuffer }, [&]() {
+         obj_shader.use();
+         obj_shader.set_uniform("shadow_cascades", bind_shadows());
+         obj_shader.set_uniform("enable", enable);
+
+         vertex_statistics.begin(ShadowCascades::count + 1);
+         obj.render(obj_shader, obj_textute, cubemap_texture, projection * view);
+         vertex_statistics.end();
+         get_gl_state().bind_vertex_array(0);
+      });
+
+      render_graph.add_pass("gui", {}, { backbuffer }, [&]() {
+         // Generate gui render commands
+         ImGui::Render();
+
+         // Execute gui render commands using OpenGL backend
+         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+      });
+
+      render_graph.execute();
+
+      state_calls = get_gl_state().get_calls_count();
+      state_skipped = get_gl_state().get_skipped_count();
+      get_gl_state().reset_counts();
 
-      // Generate gui render commands
-      ImGui::Render();
+      // Swap the backbuffer with the frontbuffer that is used for screen display
+      if (fast_replay) {
+         glFinish();
+      } else {
+         glfwSwapBuffers(window);
+      }
 
-      // Execute gui render commands using OpenGL backend
-      ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+   }
 
-      // Swap the backbuffer with the frontbuffer that is used for screen display
-      glfwSwapBuffers(window);
+   if (replay) {
+      double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+      std::cout << fmt::format("replayed {} frames in {:.1f} ms, {:.3f} ms per frame\n", frames_count, elapsed, elapsed / std::max<size_t>(frames_count, 1));
+   }
 
+   if (!trace_path.empty()) {
+      Profiler::write_chrome_trace(trace_path);
    }
 
    // Cleanup
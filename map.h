@@ -4,6 +4,7 @@
 #include <math.h>
 #include <chrono>
 #include "torus.h"
+#include "profiler.h"
 #include <glm/gtc/constants.hpp>
 #include <glm/gtx/transform.hpp>
 #include <glm/glm.hpp>
@@ -12,120 +13,137 @@
 
 class Map {
 
-    typedef std::chrono::time_point<std::chrono::high_resolution_clock> Time;
+    public:
 
-    private:
-    
-    glm::vec2 position = glm::vec2(750, 150);
-    glm::vec2 direction = glm::vec2(0, 1);
+    // Everything the simulation advances; grid_size is the torus grid position is in.
+    struct State {
+        glm::vec2 position = glm::vec2(750, 150);
+        float alpha = 0.0f;
+        glm::vec2 grid_size = glm::vec2(1);
+    };
+
+    // Controls read on the render thread, and the current torus grid.
+    struct Input {
+        float speed = 0.0f;
+        float turn = 0.0f;
+        glm::vec2 grid_size = glm::vec2(1);
+    };
+
+    // Grid cells per second at full speed, and radians per second at full speed.
+    static constexpr float move_speed = 1e9f / 24370543;
+    static constexpr float turn_speed = 0.03f * 60;
 
-    float alpha = 0.0f;
-    float speed = 0.0f;
+    private:
 
-    Torus torus;
+    State state;
 
-    Time prev_time;
+    Torus& torus;
 
     int time_delta = 24370543;
 
 
+    static glm::vec2 get_direction(float alpha) {
+        return glm::vec2(cos(alpha), sin(alpha));
+    }
+
     public:
     
-    Map(const Torus& torus, Time start_time) : torus(torus) , prev_time(start_time) {}
+    Map(Torus& torus) : torus(torus) {
+        state.grid_size = get_grid_size();
+    }
 
 
-    int move(Time current_time) {
+    glm::vec2 get_grid_size() {
+        return glm::vec2(torus.get_y_count(), torus.get_x_count());
+    }
 
-        int d_time = std::chrono::duration_cast<std::chrono::nanoseconds>(current_time - prev_time).count();
 
-        position += glm::vec2(direction[0], direction[1]) * (speed / time_delta * d_time);
-        prev_time = current_time;
+    // Advances s by dt seconds; called from the simulation thread, so it must not touch the torus.
+    static State step(State s, const Input& input, float dt) {
+        PROFILE_ZONE("Map::step");
+
+        // Keeps the object at the same place of the surface when the torus grid is rebuilt.
+        // From a grid of a single row or column there is no place to keep, only NaNs.
+        if (input.grid_size != s.grid_size) {
+            if (s.grid_size[0] > 1 && s.grid_size[1] > 1) {
+                s.position = s.position * (input.grid_size - 1.f) / (s.grid_size - 1.f);
+            }
+            s.grid_size = input.grid_size;
+        }
+
+        s.alpha += input.speed * input.turn * turn_speed * dt;
+        if (abs(s.alpha) > 2 * 3.14) {
+            s.alpha = 0;
+        }
+
+        s.position += get_direction(s.alpha) * (input.speed * move_speed * dt);
     
-        if (position[0] >= torus.get_y_count()) {
-            position[0] = 0;
+        if (s.position[0] >= s.grid_size[0]) {
+            s.position[0] = 0;
         }
-        if (position[0] < 0) {
-            position[0] = torus.get_y_count();
+        if (s.position[0] < 0) {
+            s.position[0] = s.grid_size[0];
         }
-        if (position[1] >= torus.get_x_count()) {
-            position[1] = 0;
+        if (s.position[1] >= s.grid_size[1]) {
+            s.position[1] = 0;
         }
-        if (position[1] < 0) {
-            position[1] = torus.get_x_count();
+        if (s.position[1] < 0) {
+            s.position[1] = s.grid_size[1];
         }
 
-        return d_time;
+        return s;
     }
 
 
-    glm::mat4 get_rotation_matrix() {
-        return glm::rotate(alpha, glm::vec3(1, 0, 0));
-    }
-
-    float get_angle() {
-        return alpha;
-    }
+    // State t of the way from a to b; jumps (wrapping around the grid, resetting
+    // the angle, a new grid) are not interpolated.
+    static State interpolate(const State& a, const State& b, float t) {
+        glm::vec2 d = glm::abs(b.position - a.position);
+        if (a.grid_size != b.grid_size || d[0] > b.grid_size[0] / 2 || d[1] > b.grid_size[1] / 2 ||
+            abs(b.alpha - a.alpha) > 3.14f) {
+            return b;
+        }
 
-    int get_time_delta() {
-        return time_delta;
+        State s = b;
+        s.position = glm::mix(a.position, b.position, t);
+        s.alpha = glm::mix(a.alpha, b.alpha, t);
+        return s;
     }
 
 
-    glm::vec3 get_torus_dir_x() {
-        auto pos_x = get_point_on_torus()[0];
-        auto pos_y = get_point_on_torus()[1];
-        glm::vec3 point1 = torus.get_vertex(pos_x, pos_y);
-        glm::vec3 point2 = torus.get_vertex(pos_x + 1, pos_y);
+    const State& get_state() {
+        return state;
+    }
 
-        return point2 - point1;
+    // The state drawn this frame.
+    void set_state(const State& s) {
+        state = s;
     }
 
 
-    glm::vec3 get_torus_dir_y() {
-        auto pos_x = get_point_on_torus()[0];
-        auto pos_y = get_point_on_torus()[1];
-        glm::vec3 point1 = torus.get_vertex(pos_x, pos_y);
-        glm::vec3 point2 = torus.get_vertex(pos_x, pos_y + 1);
+    glm::mat4 get_rotation_matrix() {
+        return glm::rotate(state.alpha, glm::vec3(1, 0, 0));
+    }
 
-        return point2 - point1;
+    float get_angle() {
+        return state.alpha;
     }
 
+    int get_time_delta() {
+        return time_delta;
+    }
 
-    glm::vec3 get_torus_dir() {
-        auto pos_x = get_point_on_torus()[0];
-        auto pos_y = get_point_on_torus()[1];
-        glm::vec3 point1 = torus.get_vertex(pos_x, pos_y);
-        glm::vec3 point2 = torus.get_vertex(pos_x + 2.f * direction[0], pos_y + 2.f * direction[1]);
 
-        return point2 - point1;
+    SurfaceSample get_surface_sample() {
+        glm::vec2 position = state.position * (get_grid_size() - 1.f) / (state.grid_size - 1.f);
+        return torus.sample(position);
     }
 
-    glm::vec2 & get_point_on_torus() {
-        return position;
+    glm::vec2 get_point_on_torus() {
+        return state.position;
     }
 
     glm::vec2 get_direction_on_torus() {
-        return glm::normalize(direction);
-    }
-
-    void buttons_callback() {
-        if (ImGui::IsKeyDown(GLFW_KEY_UP)) {
-            speed = -1.0f;
-        }
-        else if (ImGui::IsKeyDown(GLFW_KEY_DOWN)) {
-            speed = 1.0f;
-        } else {
-            speed = 0;
-        }
-        if (ImGui::IsKeyDown(GLFW_KEY_RIGHT)) {
-            alpha += speed * 0.03f;
-        }
-        if (ImGui::IsKeyDown(GLFW_KEY_LEFT)) {
-            alpha -= speed * 0.03f;
-        }
-        if (abs(alpha) > 2 * 3.14) {
-            alpha = 0;
-        }
-        direction = glm::vec2(cos(alpha), sin(alpha));
+        return get_direction(state.alpha);
     }
-};
\ No newline at end of file
+};
@@ -2,12 +2,29 @@
 #include <string>
 #include <vector>
 #include <iostream>
+#include <map>
+#include <tuple>
+#include <algorithm>
 #define TINYOBJLOADER_IMPLEMENTATION 
 #include "tiny_obj_loader.h"
 #include "opengl_shader.h"
+#include "gl_state.h"
+#include "frustum.h"
+#include "vertex_packing.h"
+#include "vertex_cache.h"
+#include "profiler.h"
 using namespace std;
 
 
+// Position relative to the object bounds (w unused), octahedral normal and
+// texture coordinates relative to their bounds; 16 bytes.
+struct PackedObjectVertex {
+    uint16_t position[4];
+    int16_t normal[2];
+    uint16_t tex_coords[2];
+};
+
+
 class Object {
 
   private:
@@ -15,18 +32,119 @@ class Object {
   float object_scale = 0.005;
 
   size_t vertices_count;
+  GLenum index_type;
 
   GLuint vbo;
   GLuint vao;
   GLuint ebo;
+  GLuint instance_vbo;
+
+  // Model matrices of all instances, and of the ones that passed culling for the last draw.
+  std::vector<glm::mat4> instances;
+  std::vector<glm::mat4> visible;
+
+  // The draws of a frame write their visible instances one after another into the
+  // instance buffer, orphaned once per frame; sizes are in matrices.
+  size_t instance_capacity = 0;
+  size_t instance_offset = 0;
 
   float min_x = std::numeric_limits<float>::max();
   float min_y = std::numeric_limits<float>::max();
   float min_z = std::numeric_limits<float>::max();
 
-  float max_x = std::numeric_limits<float>::min();
-  float max_y = std::numeric_limits<float>::min();
-  float max_z = std::numeric_limits<float>::min();
+  float max_x = std::numeric_limits<float>::lowest();
+  float max_y = std::numeric_limits<float>::lowest();
+  float max_z = std::numeric_limits<float>::lowest();
+
+  glm::vec2 tex_min = glm::vec2(std::numeric_limits<float>::max());
+  glm::vec2 tex_extent;
+
+  float acmr_before = 0;
+  float acmr_after = 0;
+
+  // The index list as loaded and reordered by VertexCache::optimize; the first is
+  // in the index buffer unless vertex_cache_order is set.
+  std::vector<unsigned int> loaded_indices;
+  std::vector<unsigned int> cache_indices;
+  bool vertex_cache_order = false;
+
+  glm::vec3 get_min() {
+      return glm::vec3(min_x, min_y, min_z);
+  }
+
+  glm::vec3 get_max() {
+      return glm::vec3(max_x, max_y, max_z);
+  }
+
+  void set_bounds(shader_t& shader) {
+      glm::vec3 extent = get_extent(get_min(), get_max());
+      shader.set_uniform("position_min", min_x, min_y, min_z);
+      shader.set_uniform("position_extent", extent.x, extent.y, extent.z);
+  }
+
+  // Uploads the instances whose bounding sphere is in the frustum of vp and
+  // returns how many there are.
+  size_t upload_visible(const glm::mat4& vp) {
+      Frustum frustum(vp);
+      glm::vec3 center = get_center();
+      float radius = glm::length(get_max() - get_min()) / 2;
+
+      visible.clear();
+      for (const auto& model : instances) {
+          float scale = std::max({
+              glm::length(glm::vec3(model[0])),
+              glm::length(glm::vec3(model[1])),
+              glm::length(glm::vec3(model[2]))
+          });
+          if (frustum.intersects(glm::vec3(model * glm::vec4(center, 1)), radius * scale)) {
+              visible.push_back(model);
+          }
+      }
+
+      get_gl_state().bind_vertex_array(vao);
+      glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+
+      // Only until the buffer has grown to what a frame needs.
+      if (instance_offset + visible.size() > instance_capacity) {
+          instance_capacity = std::max(2 * instance_capacity, instance_offset + visible.size());
+          instance_offset = 0;
+          glBufferData(GL_ARRAY_BUFFER, sizeof(glm::mat4) * instance_capacity, nullptr, GL_STREAM_DRAW);
+      }
+
+      glBufferSubData(GL_ARRAY_BUFFER, sizeof(glm::mat4) * instance_offset, sizeof(glm::mat4) * visible.size(), visible.data());
+      for (int k = 0; k < 4; k++) {
+          size_t offset = sizeof(glm::mat4) * instance_offset + sizeof(glm::vec4) * k;
+          glVertexAttribPointer(6 + k, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void *) offset);
+      }
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+      instance_offset += visible.size();
+      return visible.size();
+  }
+
+  void draw_instances(const glm::mat4& vp) {
+      PROFILE_ZONE("Object::draw_instances");
+      size_t count = upload_visible(vp);
+      if (count > 0) {
+          glDrawElementsInstanced(GL_TRIANGLES, vertices_count, index_type, 0, count);
+      }
+  }
+
+  template<typename T>
+  void upload_indices(const std::vector<unsigned int>& vertices_indices) {
+      std::vector<T> indices(vertices_indices.begin(), vertices_indices.end());
+      glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(T) * indices.size(), indices.data(), GL_STATIC_DRAW);
+  }
+
+  // Into the bound index buffer as index_type, in the order vertex_cache_order selects.
+  void upload_indices() {
+      const std::vector<unsigned int>& indices = vertex_cache_order ? cache_indices : loaded_indices;
+      if (index_type == GL_UNSIGNED_SHORT) {
+          upload_indices<uint16_t>(indices);
+      } else {
+          upload_indices<unsigned int>(indices);
+      }
+  }
 
   public:
 
@@ -36,53 +154,71 @@ class Object {
     std::vector<float>& colors,
     std::vector<unsigned int>& vertices_indices
   ) {
-        GLuint vbo, vao, ebo;
+        GLuint vbo, vao, ebo, instance_vbo;
 
         vertices_count = vertices_indices.size();
-        
-        float triangle_vertices[vertices_indices.size() * 8] = { 0 };
-        unsigned int triangle_indices[vertices_count] = { 0 };
-
-        for (size_t i = 0, j = 0, k = 0; k < vertices_indices.size() * 8; i += 3, j += 2, k+=8) {
-            triangle_vertices[k] = vertices[i];
-            triangle_vertices[k + 1] = vertices[i + 1];
-            triangle_vertices[k + 2] = vertices[i  + 2];
- 
-            triangle_vertices[k + 3] = normals[i];
-            triangle_vertices[k + 4] = normals[i + 1];
-            triangle_vertices[k + 5] = normals[i  + 2];
-
-            triangle_vertices[k + 6] = colors[j];
-            triangle_vertices[k + 7] = colors[j + 1];
+
+        loaded_indices = vertices_indices;
+        cache_indices = vertices_indices;
+        VertexCache::optimize(cache_indices.data(), cache_indices.size(), vertices.size() / 3);
+        acmr_before = VertexCache::get_acmr(loaded_indices.data(), loaded_indices.size());
+        acmr_after = VertexCache::get_acmr(cache_indices.data(), cache_indices.size());
+
+        compute_min_max(vertices);
+
+        glm::vec2 tex_max = glm::vec2(std::numeric_limits<float>::lowest());
+        for (size_t j = 0; j < colors.size(); j += 2) {
+            tex_min = glm::min(tex_min, glm::vec2(colors[j], colors[j + 1]));
+            tex_max = glm::max(tex_max, glm::vec2(colors[j], colors[j + 1]));
         }
+        tex_extent = glm::max(tex_max - tex_min, glm::vec2(1e-6f));
 
-        for (size_t i = 0; i < vertices_indices.size(); i++) {
-            triangle_indices[i] = vertices_indices[i];
-        } 
+        glm::vec3 position_extent = get_extent(get_min(), get_max());
+        std::vector<PackedObjectVertex> triangle_vertices(vertices.size() / 3);
+
+        for (size_t k = 0, i = 0, j = 0; k < triangle_vertices.size(); k++, i += 3, j += 2) {
+            PackedObjectVertex& vertex = triangle_vertices[k];
+
+            pack_position(glm::vec3(vertices[i], vertices[i + 1], vertices[i + 2]), get_min(), position_extent, vertex.position);
+            vertex.position[3] = 0;
+            pack_normal(glm::normalize(glm::vec3(normals[i], normals[i + 1], normals[i + 2])), vertex.normal);
+            vertex.tex_coords[0] = pack_unorm16((colors[j] - tex_min.x) / tex_extent.x);
+            vertex.tex_coords[1] = pack_unorm16((colors[j + 1] - tex_min.y) / tex_extent.y);
+        }
 
         glGenVertexArrays(1, &vao);
         glGenBuffers(1, &vbo);
         glGenBuffers(1, &ebo);
-        glBindVertexArray(vao);
+        get_gl_state().bind_vertex_array(vao);
         glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(triangle_vertices), triangle_vertices, GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(PackedObjectVertex) * triangle_vertices.size(), triangle_vertices.data(), GL_STATIC_DRAW);
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(triangle_indices), triangle_indices, GL_STATIC_DRAW);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void *)0);
+        // 16-bit indices whenever the vertices allow it.
+        index_type = triangle_vertices.size() <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+        upload_indices();
+        glVertexAttribPointer(0, 4, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedObjectVertex), (void *) offsetof(PackedObjectVertex, position));
         glEnableVertexAttribArray(0);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void *)(3 * sizeof(float)));
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(PackedObjectVertex), (void *) offsetof(PackedObjectVertex, normal));
         glEnableVertexAttribArray(1);
-        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void *)(6 * sizeof(float)));
+        glVertexAttribPointer(2, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedObjectVertex), (void *) offsetof(PackedObjectVertex, tex_coords));
         glEnableVertexAttribArray(2);
 
+        // Per instance model matrix, one column per location.
+        glGenBuffers(1, &instance_vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+        for (int k = 0; k < 4; k++) {
+            glVertexAttribPointer(6 + k, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void *) (sizeof(glm::vec4) * k));
+            glEnableVertexAttribArray(6 + k);
+            glVertexAttribDivisor(6 + k, 1);
+        }
+
         glBindBuffer(GL_ARRAY_BUFFER, 0);
-        glBindVertexArray(0);
+        get_gl_state().bind_vertex_array(0);
 
         this->vbo = vbo;
         this->vao = vao;
         this->ebo = ebo;
-
-        compute_min_max(vertices);
+        this->instance_vbo = instance_vbo;
   }
 
 
@@ -96,7 +232,7 @@ class Object {
           min_z = min(min_z, z);
           max_x = max(max_x, x);
           max_y = max(max_y, y);
-          max_z = min(max_z, z);
+          max_z = max(max_z, z);
       }
   }
 
@@ -132,25 +268,74 @@ class Object {
       return max_z - min_z;
   }
 
-  void render(shader_t& shader, GLuint texture, GLuint cubemap_texture) {
+  // Average cache miss ratio of the index list as loaded and in vertex cache order.
+  glm::vec2 get_acmr() {
+      return glm::vec2(acmr_before, acmr_after);
+  }
 
-        glActiveTexture(GL_TEXTURE0);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glBindTexture(GL_TEXTURE_2D, texture);
+  bool get_vertex_cache_order() {
+      return vertex_cache_order;
+  }
 
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap_texture);
+  // Draws with the index list in vertex cache order or as loaded.
+  void set_vertex_cache_order(bool enabled) {
+      if (enabled == vertex_cache_order) {
+          return;
+      }
+      vertex_cache_order = enabled;
+      get_gl_state().bind_vertex_array(vao);
+      upload_indices();
+      get_gl_state().bind_vertex_array(0);
+  }
+
+  void set_instances(const std::vector<glm::mat4>& models) {
+      instances = models;
+  }
+
+  void set_instance(size_t k, const glm::mat4& model) {
+      instances[k] = model;
+  }
+
+  // Orphans the instance buffer before the first draw of a frame.
+  void begin_instances() {
+      glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+      glBufferData(GL_ARRAY_BUFFER, sizeof(glm::mat4) * instance_capacity, nullptr, GL_STREAM_DRAW);
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+      instance_offset = 0;
+  }
+
+  size_t get_triangles_count() {
+      return vertices_count / 3;
+  }
+
+  size_t get_instances_count() {
+      return instances.size();
+  }
+
+  // Instances drawn by the last render or render_depth call.
+  size_t get_visible_count() {
+      return visible.size();
+  }
+
+  // One instanced draw of the instances visible through vp (view-projection).
+  void render(shader_t& shader, GLuint texture, GLuint cubemap_texture, const glm::mat4& vp) {
 
         shader.use();
-        glBindVertexArray(vao);
+        shader.set_uniform("obj_texture", get_gl_state().bind_texture(GL_TEXTURE_2D, texture));
+        shader.set_uniform("cubemap_texture", get_gl_state().bind_texture(GL_TEXTURE_CUBE_MAP, cubemap_texture));
+        set_bounds(shader);
+        shader.set_uniform("tex_min", tex_min.x, tex_min.y);
+        shader.set_uniform("tex_extent", tex_extent.x, tex_extent.y);
 
-        glDrawElements(GL_TRIANGLES, vertices_count, GL_UNSIGNED_INT, 0);
+        draw_instances(vp);
   }
 
-  void render() {
-      glBindVertexArray(vao);
-      glDrawElements(GL_TRIANGLES, vertices_count, GL_UNSIGNED_INT, 0);
+  // Depth of the instances visible through vp, with the shadow shader in use and its
+  // mvp set to vp; the instances are not torus tiles.
+  void render_depth(shader_t& shader, const glm::mat4& vp) {
+      shader.set_uniform("tile_positions", 0);
+      set_bounds(shader);
+      draw_instances(vp);
   }
 
   glm::mat4 get_model_matrix() {
@@ -191,11 +376,22 @@ class ObjLoader {
         std::vector<float> colors;
         std::vector<unsigned int> vertices_indices;
 
+        // Corners sharing position, normal and texture coordinates become one vertex.
+        std::map<std::tuple<int, int, int>, unsigned int> welded;
+
         for (auto const & shape : shapes) {
             for (size_t i = 0; i < shape.mesh.indices.size(); i++) {
                 auto idx = shape.mesh.indices[i];
-                
-                vertices_indices.push_back(i);
+
+                auto key = std::make_tuple(idx.vertex_index, idx.normal_index, idx.texcoord_index);
+                auto found = welded.find(key);
+                if (found != welded.end()) {
+                    vertices_indices.push_back(found->second);
+                    continue;
+                }
+                unsigned int index = welded.size();
+                welded[key] = index;
+                vertices_indices.push_back(index);
 
                 vertices.push_back(attrib.vertices[3 * idx.vertex_index + 0]); 
                 vertices.push_back(attrib.vertices[3 * idx.vertex_index + 1]);
@@ -1,5 +1,8 @@
 #include "opengl_shader.h"
+#include "gl_state.h"
 
+#include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <sstream>
 #include <iostream>
@@ -21,12 +24,40 @@ namespace
       return file_stream.str();
 
    }
+
+   // Replaces `#include "file"` lines with the contents of file, looked up
+   // next to the including shader.
+   std::string resolve_includes(const std::string & code, const std::string & fname)
+   {
+      const std::string directive = "#include";
+      const auto slash = fname.find_last_of("/\\");
+      const std::string directory = slash == std::string::npos ? "" : fname.substr(0, slash + 1);
+
+      std::stringstream input(code);
+      std::stringstream output;
+      std::string line;
+      while (std::getline(input, line))
+      {
+         const auto begin = line.find('"');
+         const auto end = line.rfind('"');
+         if (line.compare(0, directive.size(), directive) == 0 && begin != end)
+         {
+            const auto include_fname = directory + line.substr(begin + 1, end - begin - 1);
+            output << resolve_includes(read_shader_code(include_fname), include_fname) << "\n";
+         }
+         else
+         {
+            output << line << "\n";
+         }
+      }
+      return output.str();
+   }
 }
 
 shader_t::shader_t(const std::string& vertex_code_fname, const std::string& fragment_code_fname)
 {
-   const auto vertex_code = read_shader_code(vertex_code_fname);
-   const auto fragment_code = read_shader_code(fragment_code_fname);
+   const auto vertex_code = resolve_includes(read_shader_code(vertex_code_fname), vertex_code_fname);
+   const auto fragment_code = resolve_includes(read_shader_code(fragment_code_fname), fragment_code_fname);
    compile(vertex_code, fragment_code);
    link();
 }
@@ -56,40 +87,87 @@ void shader_t::link() {
    check_linking_error();
    glDeleteShader(vertex_id_);
    glDeleteShader(fragment_id_);
+   reflect_uniforms();
+}
+
+// Locations of all active uniforms, looked up once instead of on every set_uniform.
+// Arrays are listed as "name[0]" and are also found by their plain name; uniforms
+// in blocks have no location.
+void shader_t::reflect_uniforms() {
+   GLint count = 0;
+   GLint max_length = 0;
+   glGetProgramiv(program_id_, GL_ACTIVE_UNIFORMS, &count);
+   glGetProgramiv(program_id_, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+
+   std::vector<GLchar> name(max_length + 1);
+   for (GLint k = 0; k < count; k++)
+   {
+      GLsizei length = 0;
+      GLint size = 0;
+      GLenum type = 0;
+      glGetActiveUniform(program_id_, k, name.size(), &length, &size, &type, name.data());
+
+      const std::string uniform(name.data(), length);
+      const GLint location = glGetUniformLocation(program_id_, uniform.c_str());
+      if (location < 0)
+      {
+         continue;
+      }
+      uniform_locations_.emplace_back(uniform, location);
+      if (uniform.size() > 3 && uniform.compare(uniform.size() - 3, 3, "[0]") == 0)
+      {
+         uniform_locations_.emplace_back(uniform.substr(0, uniform.size() - 3), location);
+      }
+   }
+   std::sort(uniform_locations_.begin(), uniform_locations_.end());
+}
+
+GLint shader_t::get_uniform_location(const char* name) const {
+   const auto it = std::lower_bound(uniform_locations_.begin(), uniform_locations_.end(), name,
+      [](const std::pair<std::string, GLint>& uniform, const char* key) { return std::strcmp(uniform.first.c_str(), key) < 0; });
+   return it == uniform_locations_.end() || std::strcmp(it->first.c_str(), name) != 0 ? -1 : it->second;
+}
+
+void shader_t::bind_uniform_block(const std::string& name, GLuint binding) {
+   const GLuint index = glGetUniformBlockIndex(program_id_, name.c_str());
+   if (index != GL_INVALID_INDEX)
+   {
+      glUniformBlockBinding(program_id_, index, binding);
+   }
 }
 
 void shader_t::use() {
-   glUseProgram(program_id_);
+   get_gl_state().use_program(program_id_);
 }
 
 template<>
-void shader_t::set_uniform<int>(const std::string& name, int val) {
-   glUniform1i(glGetUniformLocation(program_id_, name.c_str()), val);
+void shader_t::set_uniform<int>(const char* name, int val) {
+   glUniform1i(get_uniform_location(name), val);
 }
 
 template<>
-void shader_t::set_uniform<bool>(const std::string& name, bool val) {
-   glUniform1i(glGetUniformLocation(program_id_, name.c_str()), val);
+void shader_t::set_uniform<bool>(const char* name, bool val) {
+   glUniform1i(get_uniform_location(name), val);
 }
 
 template<>
-void shader_t::set_uniform<float>(const std::string& name, float val) {
-   glUniform1f(glGetUniformLocation(program_id_, name.c_str()), val);
+void shader_t::set_uniform<float>(const char* name, float val) {
+   glUniform1f(get_uniform_location(name), val);
 }
 
 template<>
-void shader_t::set_uniform<float>(const std::string& name, float val1, float val2) {
-   glUniform2f(glGetUniformLocation(program_id_, name.c_str()), val1, val2);
+void shader_t::set_uniform<float>(const char* name, float val1, float val2) {
+   glUniform2f(get_uniform_location(name), val1, val2);
 }
 
 template<>
-void shader_t::set_uniform<float>(const std::string& name, float val1, float val2, float val3) {
-   glUniform3f(glGetUniformLocation(program_id_, name.c_str()), val1, val2, val3);
+void shader_t::set_uniform<float>(const char* name, float val1, float val2, float val3) {
+   glUniform3f(get_uniform_location(name), val1, val2, val3);
 }
 
 template<>
-void shader_t::set_uniform<float*>(const std::string& name, float* val) {
-   glUniformMatrix4fv(glGetUniformLocation(program_id_, name.c_str()), 1, GL_FALSE, val);
+void shader_t::set_uniform<float*>(const char* name, float* val) {
+   glUniformMatrix4fv(get_uniform_location(name), 1, GL_FALSE, val);
 }
 
 void shader_t::check_compile_error() {
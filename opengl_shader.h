@@ -2,6 +2,7 @@
 
 #include <string>
 #include <vector>
+#include <utility>
 
 #include <GL/glew.h>
 
@@ -12,15 +13,22 @@ public:
    ~shader_t();
 
    void use();
-   template<typename T> void set_uniform(const std::string& name, T val);
-   template<typename T> void set_uniform(const std::string& name, T val1, T val2);
-   template<typename T> void set_uniform(const std::string& name, T val1, T val2, T val3);
+   template<typename T> void set_uniform(const char* name, T val);
+   template<typename T> void set_uniform(const char* name, T val1, T val2);
+   template<typename T> void set_uniform(const char* name, T val1, T val2, T val3);
+
+   // -1 for names that are not active uniforms of the program, which glUniform* ignores.
+   GLint get_uniform_location(const char* name) const;
+   void bind_uniform_block(const std::string& name, GLuint binding);
 
 private:
    void check_compile_error();
    void check_linking_error();
    void compile(const std::string& vertex_code, const std::string& fragment_code);
    void link();
+   void reflect_uniforms();
 
    GLuint vertex_id_, fragment_id_, program_id_;
+   // Sorted by name, searched without building a string.
+   std::vector<std::pair<std::string, GLint>> uniform_locations_;
 };
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+
+inline size_t get_threads_count() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+
+// Splits [begin, end) into contiguous ranges, one per hardware thread,
+// and calls f(range_begin, range_end) for each of them.
+template<class F>
+void parallel_for(size_t begin, size_t end, F&& f) {
+    if (end <= begin) {
+        return;
+    }
+
+    size_t count = end - begin;
+    size_t threads_count = std::min(get_threads_count(), count);
+    size_t chunk = (count + threads_count - 1) / threads_count;
+
+    std::vector<std::thread> threads;
+    threads.reserve(threads_count);
+
+    for (size_t from = begin + chunk; from < end; from += chunk) {
+        size_t to = std::min(from + chunk, end);
+        threads.emplace_back([&f, from, to]() { f(from, to); });
+    }
+
+    f(begin, std::min(begin + chunk, end));
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
@@ -0,0 +1,651 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <queue>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <tuple>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "torus.h"
+#include "thread_pool.h"
+
+
+// Positions and heights of the grid points to route over, row-major; the grid wraps
+// around in both directions.
+struct PlannerGrid {
+    int rows;
+    int columns;
+    std::vector<glm::vec3> vertices;
+    std::vector<float> heights;
+};
+
+
+struct PathQuery {
+    glm::vec2 start;
+    glm::vec2 goal;
+};
+
+
+// Grid points (i, j) from start to goal; empty if the goal cannot be reached.
+struct Path {
+    std::vector<glm::vec2> points;
+    float cost = 0;
+};
+
+
+// Routes over the torus grid, which wraps around in both directions. Cells are grid
+// vertices connected to their 8 neighbours; a move costs its length on the surface,
+// increased with the slope, and moves steeper than max_slope are impossible.
+//
+// Searches run on an HPA* abstraction: the grid is split into square clusters, a few
+// cells on both sides of every border stretch joining two connected parts of clusters
+// become abstract nodes, and the costs between the nodes of each cluster are found
+// once when the planner is built. A query connects start and goal to the nodes of
+// their clusters, runs A* on the abstract graph and refines its edges from the cached
+// cluster searches. Routes come out somewhat longer than the shortest ones.
+class PathPlanner {
+
+    private:
+
+    static constexpr int directions = 8;
+    static constexpr int di[directions] = { -1, -1, -1, 0, 0, 1, 1, 1 };
+    static constexpr int dj[directions] = { -1, 0, 1, -1, 1, -1, 0, 1 };
+    static constexpr float infinity = std::numeric_limits<float>::infinity();
+
+    // Longest border stretch still crossed through its middle only; longer ones are
+    // crossed at both ends and every entrance_spacing cells between.
+    static constexpr int max_single_entrance = 6;
+    static constexpr int entrance_spacing = 8;
+
+    struct Edge {
+        uint32_t to;
+        float cost;
+    };
+
+    // No move: the source of a search, or a cell it did not reach.
+    static constexpr uint8_t no_move = 0xff;
+
+    // Costs from one cell to the cells of its cluster, and the move that reached each.
+    struct ClusterSearch {
+        std::vector<float> cost;
+        std::vector<uint8_t> move;
+    };
+
+    int rows;
+    int columns;
+    int cluster_size;
+    int cluster_rows;
+    int cluster_columns;
+
+    // Cost of leaving each cell in each direction.
+    std::vector<float> costs;
+
+    // Lower bounds of the cost of one move along i, along j and diagonally.
+    float min_cost_i = infinity;
+    float min_cost_j = infinity;
+    float min_cost_diagonal = infinity;
+
+    std::vector<uint32_t> node_cells;
+    std::vector<int32_t> cell_nodes;
+    std::vector<int32_t> components;
+    std::vector<std::vector<Edge>> edges;
+    std::vector<std::vector<uint32_t>> cluster_nodes;
+
+    // Moves of the search from each node over its cluster, to refine edges without searching again.
+    std::vector<std::vector<uint8_t>> node_moves;
+
+    // Costs between the abstract nodes and a few landmark nodes far apart: by the triangle
+    // inequality, |cost(n, L) - cost(goal, L)| is at most the cost between n and the goal.
+    static constexpr int landmarks_count = 8;
+    std::vector<float> landmark_costs;
+
+    static int wrap(int a, int count) {
+        return a < 0 ? a + count : a >= count ? a - count : a;
+    }
+
+    int get_cell(int i, int j) const {
+        return i * columns + j;
+    }
+
+    int get_neighbour(int cell, int k) const {
+        return get_cell(wrap(cell / columns + di[k], rows), wrap(cell % columns + dj[k], columns));
+    }
+
+    // Grid point nearest to p, wrapped into the grid.
+    int get_cell(const glm::vec2& p) const {
+        int i = (int) std::lround(p[0]) % rows;
+        int j = (int) std::lround(p[1]) % columns;
+        return get_cell(i < 0 ? i + rows : i, j < 0 ? j + columns : j);
+    }
+
+    int get_cluster(int cell) const {
+        return (cell / columns / cluster_size) * cluster_columns + (cell % columns / cluster_size);
+    }
+
+    float get_move_cost(int from, int to) const {
+        for (int k = 0; k < directions; k++) {
+            if (get_neighbour(from, k) == to) {
+                return costs[from * directions + k];
+            }
+        }
+        return infinity;
+    }
+
+    // Admissible estimate of the cost between two cells from the cheapest moves.
+    float get_grid_heuristic(int a, int b) const {
+        int d_i = std::abs(a / columns - b / columns);
+        int d_j = std::abs(a % columns - b % columns);
+        d_i = std::min(d_i, rows - d_i);
+        d_j = std::min(d_j, columns - d_j);
+
+        // A diagonal can stand in for a straight move, and two straight moves for a diagonal.
+        float move_i = std::min(min_cost_i, min_cost_diagonal);
+        float move_j = std::min(min_cost_j, min_cost_diagonal);
+        float move_diagonal = std::min(min_cost_diagonal, move_i + move_j);
+        int diagonal = std::min(d_i, d_j);
+        return diagonal * move_diagonal + (d_i - diagonal) * move_i + (d_j - diagonal) * move_j;
+    }
+
+    int get_local(int cluster, int cell) const {
+        int i0 = cluster / cluster_columns * cluster_size;
+        int j0 = cluster % cluster_columns * cluster_size;
+        return (cell / columns - i0) * cluster_size + (cell % columns - j0);
+    }
+
+    // Dijkstra from source over the cells of its cluster; moves are symmetric, so the
+    // costs are also those of reaching source.
+    ClusterSearch search_cluster(int source) const {
+        int cluster = get_cluster(source);
+        ClusterSearch search { std::vector<float>(cluster_size * cluster_size, infinity), std::vector<uint8_t>(cluster_size * cluster_size, no_move) };
+
+        typedef std::pair<float, int> Item;
+        std::priority_queue<Item, std::vector<Item>, std::greater<Item>> open;
+        search.cost[get_local(cluster, source)] = 0;
+        open.emplace(0.f, source);
+
+        while (!open.empty()) {
+            auto [cost, cell] = open.top();
+            open.pop();
+            if (cost > search.cost[get_local(cluster, cell)]) {
+                continue;
+            }
+            for (int k = 0; k < directions; k++) {
+                int next = get_neighbour(cell, k);
+                float next_cost = cost + costs[cell * directions + k];
+                if (get_cluster(next) != cluster || next_cost >= search.cost[get_local(cluster, next)]) {
+                    continue;
+                }
+                search.cost[get_local(cluster, next)] = next_cost;
+                search.move[get_local(cluster, next)] = k;
+                open.emplace(next_cost, next);
+            }
+        }
+
+        return search;
+    }
+
+    // Cells from the source of a search to cell, or back when to_source, appended to
+    // points, whose last point is where this part starts.
+    void append_path(const std::vector<uint8_t>& moves, int cell, std::vector<glm::vec2>& points, bool to_source) const {
+        int cluster = get_cluster(cell);
+        std::vector<glm::vec2> part { glm::vec2(cell / columns, cell % columns) };
+        for (uint8_t k; (k = moves[get_local(cluster, cell)]) != no_move; ) {
+            cell = get_neighbour(cell, directions - 1 - k);
+            part.emplace_back(cell / columns, cell % columns);
+        }
+        if (!to_source) {
+            std::reverse(part.begin(), part.end());
+        }
+        points.insert(points.end(), part.begin() + (points.empty() ? 0 : 1), part.end());
+    }
+
+    // Cost of the cheapest edge from node a to node b.
+    float cost_between(uint32_t a, uint32_t b) const {
+        float cost = infinity;
+        for (const Edge& e : edges[a]) {
+            if (e.to == b) {
+                cost = std::min(cost, e.cost);
+            }
+        }
+        return cost;
+    }
+
+    uint32_t add_node(int cell) {
+        if (cell_nodes[cell] < 0) {
+            cell_nodes[cell] = node_cells.size();
+            node_cells.push_back(cell);
+            edges.emplace_back();
+            cluster_nodes[get_cluster(cell)].push_back(cell_nodes[cell]);
+        }
+        return cell_nodes[cell];
+    }
+
+    // The goal joins the abstract graph as one more node, with edges to the nodes of its
+    // cluster costing the cluster search from it. Its costs to the landmarks in that graph
+    // are then exactly the cheapest of these edges followed by the landmark costs of their
+    // node: a route leaving the goal and entering its cluster again is never cheaper than
+    // the edge between the two nodes, which is the cheapest route inside the cluster.
+    std::array<float, landmarks_count> get_goal_landmark_costs(int goal, const ClusterSearch& from_goal) const {
+        int goal_cluster = get_cluster(goal);
+        std::array<float, landmarks_count> goal_costs;
+        goal_costs.fill(infinity);
+        for (uint32_t n : cluster_nodes[goal_cluster]) {
+            float to_goal = from_goal.cost[get_local(goal_cluster, node_cells[n])];
+            for (int l = 0; l < landmarks_count; l++) {
+                goal_costs[l] = std::min(goal_costs[l], landmark_costs[n * landmarks_count + l] + to_goal);
+            }
+        }
+        return goal_costs;
+    }
+
+    // Bound from the landmarks for node n and a goal with the given landmark costs, both in
+    // the graph searched by find_path, so it never exceeds the cost between them there;
+    // infinite if the two are not connected.
+    float get_landmark_heuristic(uint32_t n, const float* goal_costs) const {
+        float result = 0;
+        for (int l = 0; l < landmarks_count; l++) {
+            float a = landmark_costs[n * landmarks_count + l];
+            float b = goal_costs[l];
+            if (a < infinity || b < infinity) {
+                result = std::max(result, std::abs(a - b));
+            }
+        }
+        return result;
+    }
+
+    // Dijkstra over the abstract graph.
+    std::vector<float> search_abstract(uint32_t source) const {
+        std::vector<float> cost(node_cells.size(), infinity);
+
+        typedef std::pair<float, uint32_t> Item;
+        std::priority_queue<Item, std::vector<Item>, std::greater<Item>> open;
+        cost[source] = 0;
+        open.emplace(0.f, source);
+
+        while (!open.empty()) {
+            auto [c, n] = open.top();
+            open.pop();
+            if (c > cost[n]) {
+                continue;
+            }
+            for (const Edge& e : edges[n]) {
+                if (c + e.cost < cost[e.to]) {
+                    cost[e.to] = c + e.cost;
+                    open.emplace(cost[e.to], e.to);
+                }
+            }
+        }
+
+        return cost;
+    }
+
+    // Each landmark is the node farthest from the ones before, within the graph part
+    // reached from the first.
+    void place_landmarks() {
+        landmark_costs.assign(node_cells.size() * landmarks_count, infinity);
+        if (node_cells.empty()) {
+            return;
+        }
+
+        std::vector<float> nearest(node_cells.size(), infinity);
+        uint32_t landmark = 0;
+        for (int l = 0; l < landmarks_count; l++) {
+            std::vector<float> cost = search_abstract(landmark);
+            for (size_t n = 0; n < node_cells.size(); n++) {
+                landmark_costs[n * landmarks_count + l] = cost[n];
+                nearest[n] = std::min(nearest[n], cost[n]);
+            }
+
+            float farthest = -1;
+            for (size_t n = 0; n < node_cells.size(); n++) {
+                if (nearest[n] < infinity && nearest[n] > farthest) {
+                    farthest = nearest[n];
+                    landmark = n;
+                }
+            }
+        }
+    }
+
+    // Labels cells with the lowest cell of the part of their cluster they can reach
+    // without leaving it.
+    void label_components(int cluster) {
+        int i0 = cluster / cluster_columns * cluster_size;
+        int j0 = cluster % cluster_columns * cluster_size;
+        int i1 = std::min(i0 + cluster_size, rows);
+        int j1 = std::min(j0 + cluster_size, columns);
+
+        std::vector<int> stack;
+        for (int i = i0; i < i1; i++) {
+            for (int j = j0; j < j1; j++) {
+                int seed = get_cell(i, j);
+                if (components[seed] >= 0) {
+                    continue;
+                }
+                components[seed] = seed;
+                stack.push_back(seed);
+                while (!stack.empty()) {
+                    int cell = stack.back();
+                    stack.pop_back();
+                    for (int k = 0; k < directions; k++) {
+                        int next = get_neighbour(cell, k);
+                        if (costs[cell * directions + k] < infinity && get_cluster(next) == cluster && components[next] < 0) {
+                            components[next] = seed;
+                            stack.push_back(next);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // Abstract nodes for the border crossed by the cells first + t * stride, t in
+    // [0, length), with the given moves. Crossings joining the same two components
+    // form an entrance: a short one is crossed in its middle, a longer one at both ends.
+    void add_entrances(int first, int stride, int length, const std::array<int, 3>& moves) {
+        struct Crossing {
+            int from;
+            int to;
+            int t;
+            int cell;
+            int k;
+        };
+
+        std::vector<Crossing> crossings;
+        for (int t = 0; t < length; t++) {
+            int cell = first + t * stride;
+            for (int k : moves) {
+                if (costs[cell * directions + k] < infinity) {
+                    int next = get_neighbour(cell, k);
+                    crossings.push_back({ components[cell], components[next], t, cell, k });
+                }
+            }
+        }
+        std::sort(crossings.begin(), crossings.end(), [](const Crossing& a, const Crossing& b) {
+            return std::tie(a.from, a.to, a.t) < std::tie(b.from, b.to, b.t);
+        });
+
+        for (size_t begin = 0, end = 0; begin < crossings.size(); begin = end) {
+            while (end < crossings.size() && crossings[end].from == crossings[begin].from && crossings[end].to == crossings[begin].to) {
+                end++;
+            }
+
+            std::vector<const Crossing*> chosen;
+            if (crossings[end - 1].t - crossings[begin].t < max_single_entrance) {
+                chosen = { &crossings[(begin + end - 1) / 2] };
+            } else {
+                chosen = { &crossings[begin] };
+                for (size_t c = begin + 1; c < end; c++) {
+                    if (crossings[c].t - chosen.back()->t >= entrance_spacing || c + 1 == end) {
+                        chosen.push_back(&crossings[c]);
+                    }
+                }
+            }
+            for (const Crossing* c : chosen) {
+                uint32_t a = add_node(c->cell);
+                uint32_t b = add_node(get_neighbour(c->cell, c->k));
+                float cost = costs[c->cell * directions + c->k];
+                edges[a].push_back({ b, cost });
+                edges[b].push_back({ a, cost });
+            }
+        }
+    }
+
+    void build_abstraction(ThreadPool& pool) {
+        cell_nodes.assign(rows * columns, -1);
+        cluster_nodes.assign(cluster_rows * cluster_columns, {});
+
+        components.assign(rows * columns, -1);
+        pool.parallel_for(0, cluster_nodes.size(), [this](size_t from, size_t to) {
+            for (size_t cluster = from; cluster < to; cluster++) {
+                label_components(cluster);
+            }
+        });
+
+        for (int ci = 0; ci < cluster_rows; ci++) {
+            for (int cj = 0; cj < cluster_columns; cj++) {
+                int i0 = ci * cluster_size;
+                int j0 = cj * cluster_size;
+                int height = std::min(cluster_size, rows - i0);
+                int width = std::min(cluster_size, columns - j0);
+
+                // The last row against the next clusters along i, the last column against
+                // the next ones along j; diagonal moves cross into the corner clusters too.
+                add_entrances(get_cell(i0 + height - 1, j0), 1, width, { 6, 5, 7 });
+                add_entrances(get_cell(i0, j0 + width - 1), columns, height, { 4, 2, 7 });
+            }
+        }
+
+        node_moves.resize(node_cells.size());
+        pool.parallel_for(0, cluster_nodes.size(), [this](size_t from, size_t to) {
+            for (size_t cluster = from; cluster < to; cluster++) {
+                for (uint32_t a : cluster_nodes[cluster]) {
+                    ClusterSearch search = search_cluster(node_cells[a]);
+                    node_moves[a] = std::move(search.move);
+                    for (uint32_t b : cluster_nodes[cluster]) {
+                        float cost = search.cost[get_local(cluster, node_cells[b])];
+                        if (b != a && cost < infinity) {
+                            edges[a].push_back({ b, cost });
+                        }
+                    }
+                }
+            }
+        });
+    }
+
+    // The grid of the torus without its last row and column, which repeat the first ones.
+    static PlannerGrid get_grid(Torus& torus, ThreadPool& pool) {
+        PlannerGrid grid { int(torus.get_y_count()) - 1, int(torus.get_x_count()) - 1 };
+        grid.vertices.resize(grid.rows * grid.columns);
+        grid.heights.resize(grid.rows * grid.columns);
+        pool.parallel_for(0, grid.rows, [&](size_t from, size_t to) {
+            for (size_t i = from; i < to; i++) {
+                for (int j = 0; j < grid.columns; j++) {
+                    grid.vertices[i * grid.columns + j] = torus.get_vertex(i, (size_t) j);
+                    grid.heights[i * grid.columns + j] = torus.get_vertex_height(i, (size_t) j);
+                }
+            }
+        });
+        return grid;
+    }
+
+    public:
+
+    PathPlanner(Torus& torus, ThreadPool& pool, float max_slope = 1.f, float slope_weight = 4.f, int cluster_size = 16)
+      : PathPlanner(get_grid(torus, pool), pool, max_slope, slope_weight, cluster_size)
+    {
+    }
+
+    PathPlanner(const PlannerGrid& grid, ThreadPool& pool, float max_slope = 1.f, float slope_weight = 4.f, int cluster_size = 16)
+      : rows(grid.rows)
+      , columns(grid.columns)
+      , cluster_size(cluster_size)
+      , cluster_rows((rows + cluster_size - 1) / cluster_size)
+      , cluster_columns((columns + cluster_size - 1) / cluster_size)
+      , costs(size_t(rows) * columns * directions)
+    {
+        const std::vector<glm::vec3>& vertices = grid.vertices;
+        const std::vector<float>& heights = grid.heights;
+        pool.parallel_for(0, rows * columns, [&](size_t from, size_t to) {
+            for (size_t cell = from; cell < to; cell++) {
+                for (int k = 0; k < directions; k++) {
+                    int next = get_neighbour(cell, k);
+                    float length = glm::length(vertices[next] - vertices[cell]);
+                    float slope = std::abs(heights[next] - heights[cell]) / std::max(length, 1e-6f);
+                    costs[cell * directions + k] = slope > max_slope ? infinity : length * (1 + slope_weight * slope);
+                }
+            }
+        });
+
+        for (size_t cell = 0; cell < costs.size() / directions; cell++) {
+            for (int k = 0; k < directions; k++) {
+                float& bound = di[k] == 0 ? min_cost_j : dj[k] == 0 ? min_cost_i : min_cost_diagonal;
+                bound = std::min(bound, costs[cell * directions + k]);
+            }
+        }
+
+        build_abstraction(pool);
+        place_landmarks();
+    }
+
+    size_t get_nodes_count() const {
+        return node_cells.size();
+    }
+
+    // Without landmarks the abstract search is guided by the octile bound alone, which
+    // finds the same routes, only slower.
+    Path find_path(const PathQuery& query, bool use_landmarks = true) const {
+        int start = get_cell(query.start);
+        int goal = get_cell(query.goal);
+        int start_cluster = get_cluster(start);
+        int goal_cluster = get_cluster(goal);
+
+        ClusterSearch from_start = search_cluster(start);
+        ClusterSearch from_goal = search_cluster(goal);
+
+        float direct = start_cluster == goal_cluster ? from_start.cost[get_local(start_cluster, goal)] : infinity;
+
+        // A* over the abstract nodes, with the goal as one more node after them.
+        uint32_t goal_node = node_cells.size();
+
+        std::array<float, landmarks_count> goal_landmark_costs = get_goal_landmark_costs(goal, from_goal);
+        auto get_heuristic = [&](uint32_t n) {
+            float grid_heuristic = get_grid_heuristic(node_cells[n], goal);
+            return use_landmarks ? std::max(grid_heuristic, get_landmark_heuristic(n, goal_landmark_costs.data())) : grid_heuristic;
+        };
+
+        std::vector<float> cost(goal_node + 1, infinity);
+        std::vector<int32_t> parent(goal_node + 1, -1);
+
+        typedef std::pair<float, uint32_t> Item;
+        std::priority_queue<Item, std::vector<Item>, std::greater<Item>> open;
+        for (uint32_t n : cluster_nodes[start_cluster]) {
+            cost[n] = from_start.cost[get_local(start_cluster, node_cells[n])];
+            if (cost[n] < direct) {
+                open.emplace(cost[n] + get_heuristic(n), n);
+            }
+        }
+
+        while (!open.empty()) {
+            auto [f, n] = open.top();
+            open.pop();
+            if (n == goal_node || f >= direct) {
+                break;
+            }
+            if (f > cost[n] + get_heuristic(n)) {
+                continue;
+            }
+
+            auto relax = [&](uint32_t to, float to_cost, float heuristic) {
+                if (to_cost < cost[to] && heuristic < infinity) {
+                    cost[to] = to_cost;
+                    parent[to] = n;
+                    open.emplace(to_cost + heuristic, to);
+                }
+            };
+
+            if (get_cluster(node_cells[n]) == goal_cluster) {
+                relax(goal_node, cost[n] + from_goal.cost[get_local(goal_cluster, node_cells[n])], 0);
+            }
+            for (const Edge& e : edges[n]) {
+                relax(e.to, cost[n] + e.cost, get_heuristic(e.to));
+            }
+        }
+
+        Path path;
+        if (direct <= cost[goal_node]) {
+            if (direct < infinity) {
+                append_path(from_goal.move, start, path.points, true);
+                path.cost = direct;
+            }
+            return path;
+        }
+        path.cost = cost[goal_node];
+
+        std::vector<uint32_t> nodes;
+        for (int32_t n = parent[goal_node]; n >= 0; n = parent[n]) {
+            nodes.push_back(n);
+        }
+        std::reverse(nodes.begin(), nodes.end());
+
+        append_path(from_start.move, node_cells[nodes.front()], path.points, false);
+        for (size_t k = 0; k + 1 < nodes.size(); k++) {
+            uint32_t a = nodes[k];
+            uint32_t b = nodes[k + 1];
+            float cost = cost_between(a, b);
+
+            // Edges between clusters are single moves; a cluster spanning the whole grid
+            // along i or j has such edges to itself too.
+            if (get_move_cost(node_cells[a], node_cells[b]) <= cost) {
+                path.points.emplace_back(node_cells[b] / columns, node_cells[b] % columns);
+            } else {
+                append_path(node_moves[a], node_cells[b], path.points, false);
+            }
+        }
+        append_path(from_goal.move, node_cells[nodes.back()], path.points, true);
+
+        return path;
+    }
+
+    // Plain A* over every cell of the grid: the shortest route, to measure how far the
+    // hierarchical ones are from it.
+    Path find_grid_path(const PathQuery& query) const {
+        int start = get_cell(query.start);
+        int goal = get_cell(query.goal);
+
+        std::vector<float> cost(rows * columns, infinity);
+        std::vector<uint8_t> move(rows * columns, no_move);
+
+        typedef std::pair<float, int> Item;
+        std::priority_queue<Item, std::vector<Item>, std::greater<Item>> open;
+        cost[start] = 0;
+        open.emplace(get_grid_heuristic(start, goal), start);
+
+        while (!open.empty()) {
+            auto [f, cell] = open.top();
+            open.pop();
+            if (cell == goal) {
+                break;
+            }
+            if (f > cost[cell] + get_grid_heuristic(cell, goal)) {
+                continue;
+            }
+            for (int k = 0; k < directions; k++) {
+                int next = get_neighbour(cell, k);
+                float next_cost = cost[cell] + costs[cell * directions + k];
+                if (next_cost < cost[next]) {
+                    cost[next] = next_cost;
+                    move[next] = k;
+                    open.emplace(next_cost + get_grid_heuristic(next, goal), next);
+                }
+            }
+        }
+
+        Path path;
+        if (cost[goal] == infinity) {
+            return path;
+        }
+        path.cost = cost[goal];
+        for (int cell = goal; ; cell = get_neighbour(cell, directions - 1 - move[cell])) {
+            path.points.emplace_back(cell / columns, cell % columns);
+            if (move[cell] == no_move) {
+                break;
+            }
+        }
+        std::reverse(path.points.begin(), path.points.end());
+        return path;
+    }
+
+    // Queries answered in parallel on the pool.
+    std::vector<Path> find_paths(const std::vector<PathQuery>& queries, ThreadPool& pool) const {
+        std::vector<Path> result(queries.size());
+        pool.parallel_for(0, queries.size(), [&](size_t from, size_t to) {
+            for (size_t k = from; k < to; k++) {
+                result[k] = find_path(queries[k]);
+            }
+        });
+        return result;
+    }
+};
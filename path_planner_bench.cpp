@@ -0,0 +1,116 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <string>
+#include <cmath>
+#include <algorithm>
+#include <fmt/format.h>
+
+#include "path_planner.h"
+
+
+// A torus of radii 4 and 1 with periodic hills, some too steep to climb.
+static PlannerGrid make_grid(int rows, int columns) {
+   const float pi = 3.14159265f;
+   PlannerGrid grid { rows, columns };
+   for (int i = 0; i < rows; i++) {
+      for (int j = 0; j < columns; j++) {
+         float u = 2 * pi * i / rows;
+         float v = 2 * pi * j / columns;
+         float height = 0.1f * std::sin(3 * u) * std::cos(5 * v) + 0.05f * std::sin(17 * u + 11 * v);
+         float r = 1 + height;
+         grid.vertices.emplace_back((4 + r * std::cos(u)) * std::cos(v), r * std::sin(u), (4 + r * std::cos(u)) * std::sin(v));
+         grid.heights.push_back(height);
+      }
+   }
+   return grid;
+}
+
+
+// Hierarchical routes against the shortest ones from plain A* on the grid: every
+// reachable goal must be found, never cheaper than the shortest route and with the
+// same cost whether the landmarks guide the search or not. Prints how much longer
+// the routes are and the queries per millisecond, and fails if a check does not hold.
+// Usage: path_planner_bench [rows] [columns] [queries]
+int main(int argc, char** argv) {
+   int rows = argc > 1 ? std::stoi(argv[1]) : 120;
+   int columns = argc > 2 ? std::stoi(argv[2]) : 480;
+   int queries_count = argc > 3 ? std::stoi(argv[3]) : 200;
+
+   ThreadPool pool;
+
+   typedef std::chrono::steady_clock Clock;
+   auto t0 = Clock::now();
+   PathPlanner planner(make_grid(rows, columns), pool);
+   auto t1 = Clock::now();
+
+   std::vector<PathQuery> queries;
+   std::mt19937 random(1);
+   std::uniform_real_distribution<float> uniform(0, 1);
+   for (int k = 0; k < queries_count; k++) {
+      queries.push_back({
+         glm::vec2(uniform(random) * rows, uniform(random) * columns),
+         glm::vec2(uniform(random) * rows, uniform(random) * columns)
+      });
+   }
+
+   auto t2 = Clock::now();
+   std::vector<Path> paths;
+   for (const PathQuery& query : queries) {
+      paths.push_back(planner.find_path(query));
+   }
+   auto t3 = Clock::now();
+   std::vector<Path> shortest;
+   for (const PathQuery& query : queries) {
+      shortest.push_back(planner.find_grid_path(query));
+   }
+   auto t4 = Clock::now();
+
+   int failures = 0;
+   int found = 0;
+   double overshoot_sum = 0;
+   double overshoot_max = 0;
+   for (int k = 0; k < queries_count; k++) {
+      float tolerance = 1e-4f * std::max(1.f, shortest[k].cost);
+      Path without_landmarks = planner.find_path(queries[k], false);
+
+      if (paths[k].points.empty() != shortest[k].points.empty()) {
+         std::cout << fmt::format("query {}: reachable {} but found {}\n", k, !shortest[k].points.empty(), !paths[k].points.empty());
+         failures++;
+         continue;
+      }
+      if (paths[k].points.empty()) {
+         continue;
+      }
+      if (paths[k].cost < shortest[k].cost - tolerance) {
+         std::cout << fmt::format("query {}: cost {} below the shortest {}\n", k, paths[k].cost, shortest[k].cost);
+         failures++;
+      }
+      if (std::abs(paths[k].cost - without_landmarks.cost) > tolerance) {
+         std::cout << fmt::format("query {}: cost {} with landmarks, {} without\n", k, paths[k].cost, without_landmarks.cost);
+         failures++;
+      }
+
+      found++;
+      if (shortest[k].cost > 0) {
+         double overshoot = paths[k].cost / shortest[k].cost - 1;
+         overshoot_sum += overshoot;
+         overshoot_max = std::max(overshoot_max, overshoot);
+      }
+   }
+
+   auto rate = [&](Clock::duration time) {
+      return queries_count / std::chrono::duration<double, std::milli>(time).count();
+   };
+
+   std::cout << fmt::format("{}x{} grid, {} abstract nodes, built in {:.1f} ms\n",
+      rows, columns, planner.get_nodes_count(), std::chrono::duration<double, std::milli>(t1 - t0).count());
+   std::cout << fmt::format("hierarchical: {:.2f} queries/ms\n", rate(t3 - t2));
+   std::cout << fmt::format("plain A*:     {:.2f} queries/ms\n", rate(t4 - t3));
+   std::cout << fmt::format("{} of {} goals reachable, routes {:.1f}% longer on average, {:.1f}% at most\n",
+      found, queries_count, found ? 100 * overshoot_sum / found : 0., 100 * overshoot_max);
+   std::cout << fmt::format("{} failed checks\n", failures);
+
+   return failures == 0 ? 0 : 1;
+}
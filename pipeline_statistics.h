@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vector>
+#include <GL/glew.h>
+
+
+// Vertex shader invocations per render pass, counted with ARB_pipeline_statistics_query
+// where the driver has it. Results are read a few frames late instead of stalling.
+class PipelineStatistics {
+
+    private:
+
+    struct Pass {
+        GLuint query = 0;
+        bool pending = false;
+        GLuint64 invocations = 0;
+    };
+
+    std::vector<Pass> passes;
+    bool supported;
+    bool active = false;
+
+    public:
+
+    PipelineStatistics(size_t passes_count)
+      : passes(passes_count)
+      , supported(GLEW_ARB_pipeline_statistics_query)
+    {
+        if (supported) {
+            for (auto& pass : passes) {
+                glGenQueries(1, &pass.query);
+            }
+        }
+    }
+
+    bool is_supported() {
+        return supported;
+    }
+
+    // A pass whose previous result has not arrived yet is skipped this frame.
+    void begin(size_t pass) {
+        active = supported && !passes[pass].pending;
+        if (active) {
+            glBeginQuery(GL_VERTEX_SHADER_INVOCATIONS_ARB, passes[pass].query);
+            passes[pass].pending = true;
+        }
+    }
+
+    void end() {
+        if (active) {
+            glEndQuery(GL_VERTEX_SHADER_INVOCATIONS_ARB);
+            active = false;
+        }
+    }
+
+    void collect() {
+        for (auto& pass : passes) {
+            GLint available = 0;
+            if (pass.pending) {
+                glGetQueryObjectiv(pass.query, GL_QUERY_RESULT_AVAILABLE, &available);
+            }
+            if (available) {
+                glGetQueryObjectui64v(pass.query, GL_QUERY_RESULT, &pass.invocations);
+                pass.pending = false;
+            }
+        }
+    }
+
+    GLuint64 get_invocations(size_t pass) {
+        return passes[pass].invocations;
+    }
+};
@@ -0,0 +1,224 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <cstdint>
+#include <stdexcept>
+
+
+// CPU time of scoped zones, written as a Chrome trace (chrome://tracing, Perfetto).
+// Each thread appends to its own buffer without locking; the trace is written from
+// what the buffers hold. Until start() a zone costs one relaxed load.
+//
+// Zone names must outlive the profiler: string literals or intern()ed names.
+class Profiler {
+
+    private:
+
+    struct Event {
+        const char* name;
+        int64_t start_ns;
+        int64_t end_ns;
+    };
+
+    static constexpr size_t chunk_size = 4096;
+
+    struct Chunk {
+        Event events[chunk_size];
+        std::atomic<Chunk*> next { nullptr };
+    };
+
+    // Written by one thread at a time; count is published after the event it covers.
+    // A thread that exits leaves its buffer to the next new thread.
+    struct ThreadBuffer {
+        size_t id;
+        std::string name;
+        std::unique_ptr<Chunk> first = std::make_unique<Chunk>();
+        Chunk* last = first.get();
+        size_t last_count = 0;
+        std::atomic<size_t> count { 0 };
+        std::atomic<bool> in_use { true };
+
+        ~ThreadBuffer() {
+            Chunk* chunk = first->next.load();
+            while (chunk) {
+                Chunk* next = chunk->next.load();
+                delete chunk;
+                chunk = next;
+            }
+        }
+    };
+
+    struct ThreadHandle {
+        ThreadBuffer* buffer = nullptr;
+
+        ~ThreadHandle() {
+            if (buffer) {
+                buffer->in_use.store(false, std::memory_order_release);
+            }
+        }
+    };
+
+    inline static std::atomic<bool> enabled { false };
+    inline static std::chrono::steady_clock::time_point epoch;
+    inline static std::mutex mutex;
+    inline static std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+    inline static std::unordered_set<std::string> names;
+
+    static ThreadBuffer& get_buffer() {
+        thread_local ThreadHandle handle;
+        if (handle.buffer) {
+            return *handle.buffer;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& buffer : buffers) {
+            if (!buffer->in_use.load(std::memory_order_acquire)) {
+                buffer->in_use.store(true, std::memory_order_relaxed);
+                handle.buffer = buffer.get();
+                return *handle.buffer;
+            }
+        }
+        buffers.push_back(std::make_unique<ThreadBuffer>());
+        buffers.back()->id = buffers.size();
+        buffers.back()->name = "thread " + std::to_string(buffers.size());
+        handle.buffer = buffers.back().get();
+        return *handle.buffer;
+    }
+
+    static void write_escaped(std::ofstream& file, const std::string& s) {
+        for (char c : s) {
+            if (c == '"' || c == '\\') {
+                file << '\\';
+            }
+            file << c;
+        }
+    }
+
+    public:
+
+    static void start() {
+        epoch = std::chrono::steady_clock::now();
+        enabled.store(true);
+    }
+
+    static bool is_enabled() {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    static int64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    // Names the row of the calling thread in the trace.
+    static void set_thread_name(const std::string& name) {
+        if (!is_enabled()) {
+            return;
+        }
+        ThreadBuffer& buffer = get_buffer();
+        std::lock_guard<std::mutex> lock(mutex);
+        buffer.name = name;
+    }
+
+    // A copy of a name built at run time that lives as long as the profiler.
+    static const char* intern(const std::string& name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return names.insert(name).first->c_str();
+    }
+
+    static void record(const char* name, int64_t start_ns, int64_t end_ns) {
+        ThreadBuffer& buffer = get_buffer();
+        if (buffer.last_count == chunk_size) {
+            Chunk* chunk = new Chunk();
+            buffer.last->next.store(chunk, std::memory_order_release);
+            buffer.last = chunk;
+            buffer.last_count = 0;
+        }
+        buffer.last->events[buffer.last_count++] = { name, start_ns, end_ns };
+        buffer.count.store(buffer.count.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Complete ("X") events in microseconds, one row per thread buffer.
+    static void write_chrome_trace(const std::string& path) {
+        std::ofstream file(path);
+        if (!file) {
+            throw std::runtime_error("can't write " + path);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        file << "{\"traceEvents\":[\n";
+        bool first_event = true;
+        for (auto& buffer : buffers) {
+            file << (first_event ? "" : ",\n");
+            file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->id << ",\"args\":{\"name\":\"";
+            write_escaped(file, buffer->name);
+            file << "\"}}";
+            first_event = false;
+
+            size_t count = buffer->count.load(std::memory_order_acquire);
+            Chunk* chunk = buffer->first.get();
+            for (size_t k = 0; k < count; k++) {
+                if (k > 0 && k % chunk_size == 0) {
+                    chunk = chunk->next.load(std::memory_order_acquire);
+                }
+                const Event& e = chunk->events[k % chunk_size];
+                file << ",\n{\"name\":\"";
+                write_escaped(file, e.name);
+                file << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->id
+                     << ",\"ts\":" << e.start_ns / 1000.0
+                     << ",\"dur\":" << (e.end_ns - e.start_ns) / 1000.0 << "}";
+            }
+        }
+        file << "\n]}\n";
+    }
+};
+
+
+// Records the time from its construction to end() or its destruction.
+class ProfileZone {
+
+    private:
+
+    const char* name;
+    int64_t start_ns;
+    bool active;
+
+    public:
+
+    ProfileZone(const char* name)
+      : name(name)
+      , start_ns(0)
+      , active(Profiler::is_enabled())
+    {
+        if (active) {
+            start_ns = Profiler::now_ns();
+        }
+    }
+
+    ~ProfileZone() {
+        end();
+    }
+
+    ProfileZone(const ProfileZone&) = delete;
+    ProfileZone& operator=(const ProfileZone&) = delete;
+
+    void end() {
+        if (active) {
+            Profiler::record(name, start_ns, Profiler::now_ns());
+            active = false;
+        }
+    }
+};
+
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+// A zone covering the rest of the enclosing scope.
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profile_zone_, __LINE__)(name)
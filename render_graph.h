@@ -0,0 +1,294 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include <GL/glew.h>
+#include "shadow_map.h"
+#include "gpu_timers.h"
+#include "profiler.h"
+
+
+// The passes of a frame with the resources they read and write, declared anew every
+// frame. execute() runs the passes that write the backbuffer and the passes they
+// depend on, writers before readers and in declaration order otherwise; the other
+// passes are culled. A pass draws into the first resource it writes: the graph binds
+// its framebuffer and viewport, and clears it for the first pass writing it.
+//
+// Depth targets are transient: one lives from the first pass writing it to the last
+// one reading it, and targets with as many layers whose lifetimes do not overlap
+// share a Shadow_map. All the layers are cleared; a pass drawing into several
+// layers binds each of them itself.
+//
+// Every pass run is timed on the CPU and, through GpuTimers, on the GPU, and is a
+// zone of the profiler trace.
+class RenderGraph {
+
+    public:
+
+    typedef size_t Resource;
+
+    struct PassStats {
+        std::string name;
+        bool culled;
+        double cpu_ms;
+        float gpu_ms;
+    };
+
+    private:
+
+    enum class Kind {
+        backbuffer,
+        depth_target
+    };
+
+    struct ResourceNode {
+        std::string name;
+        Kind kind;
+        int width;
+        int height;
+        GLuint framebuffer;
+        int layers;
+        int physical = -1;
+    };
+
+    struct Pass {
+        std::string name;
+        std::vector<Resource> reads;
+        std::vector<Resource> writes;
+        std::function<void()> execute;
+    };
+
+    std::vector<ResourceNode> resources;
+    std::vector<Pass> passes;
+    std::vector<std::unique_ptr<Shadow_map>> depth_targets;
+    std::vector<PassStats> stats;
+    GpuTimers timers;
+
+    static bool contains(const std::vector<Resource>& list, Resource r) {
+        return std::find(list.begin(), list.end(), r) != list.end();
+    }
+
+    std::vector<bool> find_needed() {
+        std::vector<bool> needed(passes.size(), false);
+        std::vector<size_t> stack;
+        for (size_t p = 0; p < passes.size(); p++) {
+            for (Resource r : passes[p].writes) {
+                if (resources[r].kind == Kind::backbuffer && !needed[p]) {
+                    needed[p] = true;
+                    stack.push_back(p);
+                }
+            }
+        }
+
+        while (!stack.empty()) {
+            size_t p = stack.back();
+            stack.pop_back();
+            for (Resource r : passes[p].reads) {
+                for (size_t w = 0; w < passes.size(); w++) {
+                    if (!needed[w] && contains(passes[w].writes, r)) {
+                        needed[w] = true;
+                        stack.push_back(w);
+                    }
+                }
+            }
+        }
+        return needed;
+    }
+
+    // Topological order of the needed passes: a writer of a resource goes before its
+    // readers and before the later writers; the earliest declared ready pass goes first.
+    std::vector<size_t> schedule(const std::vector<bool>& needed) {
+        size_t count = passes.size();
+        std::vector<std::vector<size_t>> next(count);
+        std::vector<size_t> incoming(count, 0);
+
+        auto add_edge = [&](size_t from, size_t to) {
+            next[from].push_back(to);
+            incoming[to]++;
+        };
+
+        for (size_t a = 0; a < count; a++) {
+            for (size_t b = 0; b < count; b++) {
+                if (a == b || !needed[a] || !needed[b]) {
+                    continue;
+                }
+                for (Resource r : passes[a].writes) {
+                    bool later_writer = b > a && contains(passes[b].writes, r);
+                    if (contains(passes[b].reads, r) || later_writer) {
+                        add_edge(a, b);
+                        break;
+                    }
+                }
+            }
+        }
+
+        std::vector<size_t> order;
+        std::vector<bool> done(count, false);
+        while (true) {
+            size_t ready = count;
+            for (size_t p = 0; p < count; p++) {
+                if (needed[p] && !done[p] && incoming[p] == 0) {
+                    ready = p;
+                    break;
+                }
+            }
+            if (ready == count) {
+                break;
+            }
+            done[ready] = true;
+            order.push_back(ready);
+            for (size_t p : next[ready]) {
+                incoming[p]--;
+            }
+        }
+
+        if (order.size() != (size_t) std::count(needed.begin(), needed.end(), true)) {
+            throw std::runtime_error("render graph passes depend on each other");
+        }
+        return order;
+    }
+
+    // Greedy assignment of Shadow_maps to the depth targets in order of first use.
+    void allocate(const std::vector<size_t>& order) {
+        std::vector<int> first(resources.size(), -1);
+        std::vector<int> last(resources.size(), -1);
+        for (size_t k = 0; k < order.size(); k++) {
+            const Pass& pass = passes[order[k]];
+            for (const auto* list : { &pass.reads, &pass.writes }) {
+                for (Resource r : *list) {
+                    if (first[r] < 0) {
+                        first[r] = k;
+                    }
+                    last[r] = k;
+                }
+            }
+        }
+
+        std::vector<Resource> targets;
+        for (Resource r = 0; r < resources.size(); r++) {
+            if (resources[r].kind == Kind::depth_target && first[r] >= 0) {
+                targets.push_back(r);
+            }
+        }
+        std::sort(targets.begin(), targets.end(), [&first](Resource a, Resource b) {
+            return first[a] < first[b];
+        });
+
+        std::vector<int> busy_until(depth_targets.size(), -1);
+        for (Resource r : targets) {
+            size_t physical = 0;
+            while (physical < busy_until.size() &&
+                   (busy_until[physical] >= first[r] || depth_targets[physical]->get_layers_count() != resources[r].layers)) {
+                physical++;
+            }
+            if (physical == depth_targets.size()) {
+                busy_until.push_back(-1);
+                depth_targets.push_back(std::make_unique<Shadow_map>(resources[r].layers));
+            }
+            busy_until[physical] = last[r];
+            resources[r].physical = physical;
+        }
+    }
+
+    void bind_target(Resource r, std::vector<bool>& cleared) {
+        const ResourceNode& resource = resources[r];
+        if (resource.kind == Kind::backbuffer) {
+            glBindFramebuffer(GL_FRAMEBUFFER, resource.framebuffer);
+            glViewport(0, 0, resource.width, resource.height);
+        } else {
+            depth_targets[resource.physical]->bind_framebuffer();
+        }
+
+        if (!cleared[r]) {
+            cleared[r] = true;
+            if (resource.kind == Kind::backbuffer) {
+                glClear(unsigned(GL_COLOR_BUFFER_BIT) | unsigned(GL_DEPTH_BUFFER_BIT));
+            } else {
+                glClear(GL_DEPTH_BUFFER_BIT);
+            }
+        }
+    }
+
+    public:
+
+    // Drops the passes and resources of the previous frame; the Shadow_maps stay for reuse.
+    void reset() {
+        resources.clear();
+        passes.clear();
+    }
+
+    // The frame the passes are culled against: the window, or an offscreen framebuffer.
+    Resource import_backbuffer(const std::string& name, int width, int height, GLuint framebuffer = 0) {
+        resources.push_back({ name, Kind::backbuffer, width, height, framebuffer, 0 });
+        return resources.size() - 1;
+    }
+
+    Resource create_depth_target(const std::string& name, int layers = 1) {
+        resources.push_back({ name, Kind::depth_target, 0, 0, 0, layers });
+        return resources.size() - 1;
+    }
+
+    void add_pass(
+        const std::string& name,
+        const std::vector<Resource>& reads,
+        const std::vector<Resource>& writes,
+        std::function<void()> execute
+    ) {
+        if (writes.empty()) {
+            throw std::runtime_error("render pass " + name + " writes nothing");
+        }
+        passes.push_back({ name, reads, writes, std::move(execute) });
+    }
+
+    // The Shadow_map behind a depth target, while the passes run.
+    Shadow_map& get_depth_target(Resource r) {
+        return *depth_targets[resources[r].physical];
+    }
+
+    void execute() {
+        PROFILE_ZONE("RenderGraph::execute");
+        std::vector<bool> needed = find_needed();
+        std::vector<size_t> order = schedule(needed);
+        allocate(order);
+
+        stats.clear();
+        for (size_t p = 0; p < passes.size(); p++) {
+            stats.push_back({ passes[p].name, !needed[p], 0, 0 });
+        }
+
+        std::vector<bool> cleared(resources.size(), false);
+        for (size_t p : order) {
+            auto start = std::chrono::steady_clock::now();
+            ProfileZone zone(Profiler::is_enabled() ? Profiler::intern(passes[p].name) : "");
+            timers.begin(passes[p].name);
+            bind_target(passes[p].writes[0], cleared);
+            passes[p].execute();
+            timers.end();
+            zone.end();
+            stats[p].cpu_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            stats[p].gpu_ms = timers.get_ms(passes[p].name);
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        timers.next_frame();
+    }
+
+    // Passes of the last execute() in declaration order, with their CPU time and the
+    // latest GPU time, a few frames old.
+    const std::vector<PassStats>& get_stats() {
+        return stats;
+    }
+
+    GpuTimers& get_timers() {
+        return timers;
+    }
+
+    size_t get_depth_targets_count() {
+        return depth_targets.size();
+    }
+};
@@ -2,8 +2,7 @@
 layout (location = 0) in vec3 position;
 
 out vec3 tex_coords;
-uniform mat4 projection;
-uniform mat4 view;
+#include "frame_uniforms.glsl"
 
 void main()
 {
@@ -0,0 +1,11 @@
+// Matrices shared by all programs, filled once per frame by FrameUniforms in frame_uniforms.h.
+
+// ShadowCascades::count in shadow_cascades.h.
+#define CASCADES_COUNT 4
+
+layout (std140) uniform FrameUniforms {
+    mat4 view;
+    mat4 projection;
+    mat4 shadow_matrices[CASCADES_COUNT];
+    vec4 cascade_splits;
+};
@@ -1,23 +1,30 @@
 #version 330 core
 
-layout (location = 0) in vec3 position;
-layout (location = 1) in vec3 normal;
+layout (location = 0) in vec4 position;
+layout (location = 1) in vec2 normal;
 layout (location = 2) in vec2 tex_coords;
+layout (location = 6) in mat4 model;
+
+#include "vertex_packing.glsl"
 
 out vec3 out_normal;
 out vec3 out_position;
 out vec2 out_tex_coords;
+out float out_dist;
+
 
 
+#include "frame_uniforms.glsl"
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+uniform vec2 tex_min;
+uniform vec2 tex_extent;
 
 
 void main() {
-    out_normal = normalize(mat3(transpose(inverse(model))) * normal);
-    out_position = vec3(model * vec4(position, 1.0));
-    out_tex_coords = tex_coords;
-    gl_Position =  projection * view * model * vec4(position, 1.0);
+    vec3 p = unpack_position(position.xyz);
+    out_normal = normalize(mat3(transpose(inverse(model))) * unpack_normal(normal));
+    out_position = vec3(model * vec4(p, 1.0));
+    out_tex_coords = tex_min + tex_coords * tex_extent;
+    gl_Position =  projection * view * model * vec4(p, 1.0);
+    out_dist = gl_Position.w;
 }
\ No newline at end of file
@@ -1,9 +1,34 @@
 #version 330 core
-layout (location = 0) in vec3 position;
+layout (location = 0) in vec4 position;
+layout (location = 3) in vec4 morph_position;
+layout (location = 6) in mat4 instance_model;
+
+#include "torus_surface.glsl"
 
 uniform mat4 mvp;
 
 void main()
 {
-    gl_Position = mvp * vec4(position, 1.0);
+    if (tile_positions == 0) {
+        gl_Position = mvp * instance_model * vec4(unpack_position(position.xyz), 1.0);
+        return;
+    }
+
+    ivec2 c = get_grid_coords(gl_VertexID);
+    int level = get_morph_level(c);
+    vec3 p;
+    vec3 m;
+
+    if (procedural == 1) {
+        p = get_procedural_vertex(c).position;
+        m = p;
+        if (lod_level >= 0 && level == lod_level) {
+            m = get_procedural_morph_target(c, level).position;
+        }
+    } else {
+        p = unpack_tile_position(gl_VertexID, position.xyz);
+        m = unpack_tile_position(gl_VertexID, morph_position.xyz);
+    }
+
+    gl_Position = mvp * vec4(mix(p, m, get_morph_factor(p, level)), 1.0);
 }
@@ -0,0 +1,19 @@
+// Cascaded shadow lookup, after frame_uniforms.glsl; see ShadowCascades in shadow_cascades.h.
+
+uniform sampler2DArrayShadow shadow_cascades;
+
+// How much of the light reaches world position p at view depth dist, from 0 to 1:
+// one filtered lookup in the first cascade reaching dist, and lit past the last one.
+float get_light(vec3 p, float dist) {
+    int cascade = int(dot(vec4(greaterThan(vec4(dist), cascade_splits)), vec4(1)));
+    if (cascade >= CASCADES_COUNT) {
+        return 1.0;
+    }
+
+    vec4 position = shadow_matrices[cascade] * vec4(p, 1);
+    vec3 point = position.xyz / position.w * 0.5 + 0.5;
+    if (point.z > 1) {
+        return 1.0;
+    }
+    return texture(shadow_cascades, vec4(point.xy, cascade, point.z - 0.001));
+}
@@ -5,6 +5,7 @@ in vec3 norm;
 in vec3 texture_coords;
 in float dist;
 in vec3 pos;
+in vec3 world_pos;
 
 uniform int enable;
 
@@ -15,9 +16,6 @@ uniform sampler2D tex3;
 uniform sampler2D detail_tex1;
 uniform sampler2D detail_tex2;
 uniform sampler2D detail_tex3;
-uniform sampler2D near_shadow_map;
-uniform sampler2D far_shadow_map;
-uniform sampler2D object_shadow_map;
 
 
 uniform float detail_coef;
@@ -26,25 +24,14 @@ uniform float detail_dist;
 uniform int tex1_repeat_count;
 uniform int tex2_repeat_count;
 uniform int tex3_repeat_count;
-uniform mat4 mvp_near;
-uniform mat4 mvp_far;
-uniform mat4 mvp_object;
+#include "frame_uniforms.glsl"
+#include "shadow_cascades.glsl"
 
 vec3 global_light_direction = vec3(0, 0, 1);
 float global_light_coef = 0.15;
 
 
 void main() {
-    vec4 position = mvp_near * vec4(pos, 1);
-    vec3 point1 = position.xyz / position.w * 0.5 + 0.5;
-    position = mvp_far * vec4(pos, 1);
-    vec3 point2 = position.xyz / position.w * 0.5 + 0.5;
-    position = mvp_object * vec4(pos, 1);
-    vec3 point3 = position.xyz / position.w * 0.5 + 0.5;
-    float depth1 = texture(near_shadow_map, point1.xy).r;
-    float depth2 = texture(far_shadow_map, point2.xy).r;
-    float depth3 = texture(object_shadow_map, point3.xy).r;
-
     int coef = 2;
 
     float x1 = texture_coords.x * tex1_repeat_count - floor(texture_coords.x * tex1_repeat_count);
@@ -84,21 +71,10 @@ void main() {
         color *= detail_coef * detail_color2.x;
     }
 
-    float c = 0;
-    if (depth3 < (point3.z - 0.001) && 
-         point3.x > 0 && point3.x < 1 && point3.y > 0 && point3.y < 1 && point3.z > 0 && point3.z < 1) {
-       c = max(0, 0.3 * point3.z);
-    }
- 
     if (enable == 1) {
-        if (point1.x > 0 && point1.x < 1 && point1.y > 0 && point1.y < 1 && point1.z > 0 && point1.z < 1) {
-            color = depth1 < (point1.z - 0.001) ? color * (global_light_coef + c) : color * (global_light_coef + c) + color * (1 - (global_light_coef + c)) * light ;
-        } else {
-            color = depth2 < (point2.z - 0.001) ? color * (global_light_coef + c) : color * (global_light_coef + c) + color * (1 - (global_light_coef + c)) * light ;
-        }
-    } else {
-        color = color * (global_light_coef + c) + color * (1 - (global_light_coef + c)) * light;
+        light *= get_light(world_pos, dist);
     }
+    color = color * global_light_coef + color * (1 - global_light_coef) * light;
 
   
 
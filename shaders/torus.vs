@@ -1,24 +1,49 @@
 #version 330 core
 
-layout (location = 0) in vec3 position;
-layout (location = 1) in vec3 normal;
-layout (location = 2) in vec3 tex_coords;
+layout (location = 0) in vec4 position;
+layout (location = 1) in vec2 normal;
+layout (location = 2) in vec2 tex_coords;
+layout (location = 3) in vec4 morph_position;
+layout (location = 4) in vec2 morph_normal;
+layout (location = 5) in vec2 morph_tex_coords;
+
+#include "torus_surface.glsl"
+
+#include "frame_uniforms.glsl"
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
 
 out vec3 norm;
 out vec3 texture_coords;
 out vec3 pos;
+out vec3 world_pos;
 out float dist;
 
 void main() {
 
-    norm = normal;
-    texture_coords = tex_coords;
-    pos = position;
-    gl_Position = projection * view * model * vec4(position, 1.0);
+    ivec2 c = get_grid_coords(gl_VertexID);
+    int level = get_morph_level(c);
+    TorusVertex v;
+    TorusVertex m;
+
+    if (procedural == 1) {
+        v = get_procedural_vertex(c);
+        m = v;
+        if (lod_level >= 0 && level == lod_level) {
+            m = get_procedural_morph_target(c, level);
+        }
+    } else {
+        v = unpack_torus_vertex(gl_VertexID, position, normal, tex_coords);
+        m = unpack_torus_vertex(gl_VertexID, morph_position, morph_normal, morph_tex_coords);
+    }
+
+    float k = get_morph_factor(v.position, level);
+
+    norm = normalize(mix(v.normal, m.normal, k));
+    texture_coords = mix(v.tex_coords, m.tex_coords, k);
+    pos = mix(v.position, m.position, k);
+    world_pos = vec3(model * vec4(pos, 1.0));
+    gl_Position = projection * view * vec4(world_pos, 1.0);
     dist = gl_Position.w;
     
 }
\ No newline at end of file
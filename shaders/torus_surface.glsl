@@ -0,0 +1,177 @@
+// Shared by torus.vs and shadow.vs: packed tile vertices, level of detail morphing
+// and the procedural torus, which rebuilds every vertex from gl_VertexID, the radii
+// and the height map.
+
+#include "vertex_packing.glsl"
+
+uniform int lod_level = -1;
+uniform vec3 lod_focus;
+uniform vec2 lod_morph;
+
+uniform int procedural = 0;
+uniform float torus_R;
+uniform float torus_r;
+uniform int x_count;
+uniform int y_count;
+uniform int tiles_x;
+uniform sampler2D height_map;
+
+// Tile vertex positions are relative to the tile box, stored as two texels per tile.
+uniform int tile_positions = 0;
+uniform sampler2D tile_bounds;
+
+const int tile_size = 32;
+const int lod_levels = 6;
+const float PI = 3.14159265358979;
+
+struct TorusVertex {
+    vec3 position;
+    vec3 normal;
+    vec3 tex_coords;
+};
+
+
+float get_morph_factor(vec3 position, int level) {
+    if (lod_level < 0 || level != lod_level) {
+        return 0.0;
+    }
+    return clamp((distance(position, lod_focus) - lod_morph.x) / (lod_morph.y - lod_morph.x), 0.0, 1.0);
+}
+
+
+// (row, column) of the tile the vertex id belongs to.
+ivec2 get_tile(int id) {
+    int tile = id / ((tile_size + 1) * (tile_size + 1));
+    return ivec2(tile / tiles_x, tile - (tile / tiles_x) * tiles_x);
+}
+
+
+// Vertices of a tile are a (tile_size + 1)^2 block, clamped to the grid at its edges.
+ivec2 get_grid_coords(int id) {
+    ivec2 tile = get_tile(id);
+    int local = id - (tile.x * tiles_x + tile.y) * (tile_size + 1) * (tile_size + 1);
+    int i = tile.x * tile_size + local / (tile_size + 1);
+    int j = tile.y * tile_size + local - (local / (tile_size + 1)) * (tile_size + 1);
+    return ivec2(min(i, y_count - 1), min(j, x_count - 1));
+}
+
+
+vec3 unpack_tile_position(int id, vec3 quantized) {
+    ivec2 tile = get_tile(id);
+    vec3 box_min = texelFetch(tile_bounds, ivec2(2 * tile.y, tile.x), 0).xyz;
+    vec3 extent = texelFetch(tile_bounds, ivec2(2 * tile.y + 1, tile.x), 0).xyz;
+    return unpack_position(quantized, box_min, extent);
+}
+
+
+// position.w holds height / r.
+TorusVertex unpack_torus_vertex(int id, vec4 position, vec2 normal, vec2 tex_coords) {
+    return TorusVertex(
+        unpack_tile_position(id, position.xyz),
+        unpack_normal(normal),
+        vec3(tex_coords, position.w * torus_r)
+    );
+}
+
+
+// Same mirrored bilinear lookup as Torus::get_vertex_height(size_t, size_t).
+float get_height(ivec2 c) {
+    float ii = c.x >= y_count / 2 ? float(y_count - c.x - 1) : float(c.x);
+    float jj = c.y >= x_count / 2 ? float(x_count - c.y - 1) : float(c.y);
+    return textureLod(height_map, vec2(jj / float(x_count), ii / float(y_count)), 0.0).r * torus_r;
+}
+
+
+float get_phi(int i) {
+    return i >= y_count - 1 ? 0.0 : 2.0 * PI / float(y_count - 1) * float(i);
+}
+
+
+float get_psi(int j) {
+    return j >= x_count - 1 ? -PI : 2.0 * PI / float(x_count - 1) * float(j) - PI;
+}
+
+
+// Normal from the partial derivatives of the parametric torus along i and j,
+// with the height gradient taken from the neighbouring height map samples.
+vec3 get_normal(ivec2 c, float phi, float psi, float rho) {
+    int i1 = c.x == 0 ? y_count - 2 : c.x - 1;
+    int i2 = c.x == y_count - 1 ? 1 : c.x + 1;
+    int j1 = c.y == 0 ? x_count - 2 : c.y - 1;
+    int j2 = c.y == x_count - 1 ? 1 : c.y + 1;
+
+    float dh_di = (get_height(ivec2(i2, c.y)) - get_height(ivec2(i1, c.y))) / 2.0;
+    float dh_dj = (get_height(ivec2(c.x, j2)) - get_height(ivec2(c.x, j1))) / 2.0;
+
+    float ring = torus_R + rho * cos(psi);
+    vec3 d_phi = vec3(-ring * sin(phi), ring * cos(phi), 0.0);
+    vec3 d_psi = vec3(-rho * sin(psi) * cos(phi), -rho * sin(psi) * sin(phi), rho * cos(psi));
+    vec3 d_rho = vec3(cos(psi) * cos(phi), cos(psi) * sin(phi), sin(psi));
+
+    vec3 d_i = d_phi * (2.0 * PI / float(y_count - 1)) + d_rho * dh_di;
+    vec3 d_j = d_psi * (2.0 * PI / float(x_count - 1)) + d_rho * dh_dj;
+
+    return normalize(cross(d_i, d_j));
+}
+
+
+TorusVertex get_procedural_vertex(ivec2 c) {
+    float phi = get_phi(c.x);
+    float psi = get_psi(c.y);
+    float h = get_height(c);
+    float rho = torus_r + h;
+    float ring = torus_R + rho * cos(psi);
+
+    TorusVertex v;
+    v.position = vec3(ring * cos(phi), ring * sin(phi), rho * sin(psi));
+    v.normal = get_normal(c, phi, psi, rho);
+    v.tex_coords = vec3(float(c.y) / float(x_count - 1), float(c.x) / float(y_count - 1), h);
+    return v;
+}
+
+
+// Same rules as Torus::get_morph_level: the last row and column are even at every level.
+int get_morph_level(ivec2 c) {
+    int ii = c.x == y_count - 1 ? 0 : c.x;
+    int jj = c.y == x_count - 1 ? 0 : c.y;
+    for (int level = 0; level + 1 < lod_levels; level++) {
+        int stride = 2 << level;
+        if (ii % stride != 0 || jj % stride != 0) {
+            return level;
+        }
+    }
+    return -1;
+}
+
+
+// Same rules as Torus::fill_morph_target.
+TorusVertex get_procedural_morph_target(ivec2 c, int level) {
+    int stride = 1 << level;
+    bool odd_i = c.x != y_count - 1 && (c.x / stride) % 2 == 1;
+    bool odd_j = c.y != x_count - 1 && (c.y / stride) % 2 == 1;
+
+    ivec2 a = c;
+    ivec2 b = c;
+    if (odd_i) {
+        a.x = c.x - stride;
+        b.x = min(c.x + stride, y_count - 1);
+    }
+    if (odd_j) {
+        a.y = c.y - stride;
+        b.y = min(c.y + stride, x_count - 1);
+    }
+    if (odd_i && odd_j) {
+        int j = a.y;
+        a.y = b.y;
+        b.y = j;
+    }
+
+    TorusVertex va = get_procedural_vertex(a);
+    TorusVertex vb = get_procedural_vertex(b);
+
+    TorusVertex m;
+    m.position = (va.position + vb.position) / 2.0;
+    m.normal = normalize(va.normal + vb.normal);
+    m.tex_coords = (va.tex_coords + vb.tex_coords) / 2.0;
+    return m;
+}
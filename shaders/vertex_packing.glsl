@@ -0,0 +1,24 @@
+// Decoders for the compact vertex formats packed in vertex_packing.h. Normalized
+// attributes arrive already converted to [0, 1] (UNORM) or [-1, 1] (SNORM).
+
+uniform vec3 position_min;
+uniform vec3 position_extent;
+
+
+vec3 unpack_position(vec3 quantized, vec3 min, vec3 extent) {
+    return min + quantized * extent;
+}
+
+
+vec3 unpack_position(vec3 quantized) {
+    return unpack_position(quantized, position_min, position_extent);
+}
+
+
+vec3 unpack_normal(vec2 quantized) {
+    vec3 n = vec3(quantized, 1.0 - abs(quantized.x) - abs(quantized.y));
+    if (n.z < 0.0) {
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return normalize(n);
+}
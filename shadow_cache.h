@@ -0,0 +1,53 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include "opengl_shader.h"
+#include "shadow_map.h"
+#include "torus.h"
+
+
+// Depth of the torus seen from a light frustum that does not move, rendered again only
+// when the frustum or the torus shape changes. A frame copies it into its shadow map
+// layer and draws just the moving casters over it. The torus is cached at full detail,
+// whatever level of detail the frame selected around the vehicle.
+class ShadowCache {
+
+    private:
+
+    Shadow_map cached;
+    glm::mat4 vp;
+    size_t shape_version = 0;
+    bool valid = false;
+    size_t renders_count = 0;
+
+    public:
+
+    // Renders the torus unless the cache already holds it for vp and the current shape.
+    void update(shader_t& shadow_shader, Torus& torus, const glm::mat4& model, const glm::mat4& vp) {
+        if (valid && vp == this->vp && torus.get_shape_version() == shape_version) {
+            return;
+        }
+
+        TorusLod lod = torus.get_lod();
+        torus.reset_lod();
+        cached.bind_layer(0);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        cached.render(shadow_shader, torus, vp * model);
+        torus.set_lod(lod);
+
+        this->vp = vp;
+        shape_version = torus.get_shape_version();
+        valid = true;
+        renders_count++;
+    }
+
+    // Copies the cached depth into a layer of target and leaves that layer bound.
+    void copy_to(Shadow_map& target, int layer) {
+        target.copy_layer(cached, 0, layer);
+    }
+
+    // Times the torus was rendered into the cache.
+    size_t get_renders_count() {
+        return renders_count;
+    }
+};
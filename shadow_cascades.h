@@ -0,0 +1,132 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+#include <glm/glm.hpp>
+#include <glm/gtx/transform.hpp>
+
+
+// Light matrices of cascaded shadow maps for a directional light. The view depth up
+// to the shadow distance is split between the cascades, log-like near the camera and
+// evenly further on, and each cascade covers the bounding sphere of its slice of the
+// camera frustum. The sphere does not change as the camera turns, and its projection
+// moves in whole texels, so shadow edges stay still as the camera moves.
+//
+// With static bounds the last cascade covers them from a light frustum that does not
+// follow the camera, and takes everything past the other cascades; what it holds of
+// the static scene can then be kept between frames, see ShadowCache.
+class ShadowCascades {
+
+    public:
+
+    static constexpr int count = 4;
+
+    private:
+
+    // Weight of the logarithmic split against the even one.
+    static constexpr float split_lambda = 0.75f;
+
+    std::array<glm::mat4, count> matrices;
+    glm::vec4 splits;
+
+    bool has_static_bounds = false;
+    glm::vec3 static_center;
+    float static_radius;
+
+    // NDC depth of the point at view depth d in front of the camera.
+    static float get_ndc_depth(const glm::mat4& projection, float d) {
+        return (-projection[2][2] * d + projection[3][2]) / d;
+    }
+
+    static glm::mat4 get_light_matrix(
+        const glm::vec3& center,
+        float radius,
+        const glm::vec3& direction,
+        float caster_margin,
+        int resolution
+    ) {
+        glm::vec3 up = std::abs(direction.y) < 0.99f ? glm::vec3(0, 1, 0) : glm::vec3(1, 0, 0);
+        glm::mat4 light_view = glm::lookAt(center + direction * (radius + caster_margin), center, up);
+        glm::mat4 light_projection = glm::ortho(-radius, radius, -radius, radius, 0.f, 2 * radius + caster_margin);
+
+        // Moves the projection so that the world origin falls on a texel corner.
+        glm::vec4 origin = light_projection * light_view * glm::vec4(0, 0, 0, 1) * (resolution / 2.f);
+        glm::vec2 texel(origin.x, origin.y);
+        glm::vec2 offset = (glm::round(texel) - texel) * (2.f / resolution);
+        light_projection[3][0] += offset.x;
+        light_projection[3][1] += offset.y;
+
+        return light_projection * light_view;
+    }
+
+    public:
+
+    void set_static_bounds(const glm::vec3& center, float radius) {
+        has_static_bounds = true;
+        static_center = center;
+        static_radius = radius;
+    }
+
+    void reset_static_bounds() {
+        has_static_bounds = false;
+    }
+
+    // light_direction points to the light; casters up to caster_margin beyond a
+    // cascade towards the light still cast into it.
+    void update(
+        const glm::mat4& view,
+        const glm::mat4& projection,
+        const glm::vec3& light_direction,
+        float shadow_distance,
+        float caster_margin,
+        int resolution
+    ) {
+        float near = projection[3][2] / (projection[2][2] - 1);
+        float far = std::min(shadow_distance, projection[3][2] / (projection[2][2] + 1));
+        glm::mat4 inverse_view_projection = glm::inverse(projection * view);
+
+        glm::vec3 direction = glm::normalize(light_direction);
+        int fitted = has_static_bounds ? count - 1 : count;
+
+        float begin = near;
+        for (int k = 0; k < fitted; k++) {
+            float t = float(k + 1) / fitted;
+            float end = split_lambda * near * std::pow(far / near, t) + (1 - split_lambda) * (near + (far - near) * t);
+            splits[k] = end;
+
+            std::array<glm::vec3, 8> corners;
+            glm::vec3 center(0);
+            for (int c = 0; c < 8; c++) {
+                float z = get_ndc_depth(projection, c < 4 ? begin : end);
+                glm::vec4 p = inverse_view_projection * glm::vec4(c & 1 ? 1 : -1, c & 2 ? 1 : -1, z, 1);
+                corners[c] = glm::vec3(p) / p.w;
+                center += corners[c] / 8.f;
+            }
+            float radius = 0;
+            for (const glm::vec3& corner : corners) {
+                radius = std::max(radius, glm::distance(corner, center));
+            }
+            radius = std::ceil(radius * 16) / 16;
+
+            matrices[k] = get_light_matrix(center, radius, direction, caster_margin, resolution);
+            begin = end;
+        }
+
+        if (has_static_bounds) {
+            matrices[count - 1] = get_light_matrix(static_center, static_radius, direction, caster_margin, resolution);
+            splits[count - 1] = std::numeric_limits<float>::max();
+        }
+    }
+
+    // World to light clip space of every cascade.
+    const std::array<glm::mat4, count>& get_matrices() {
+        return matrices;
+    }
+
+    // The view depth where each cascade ends.
+    glm::vec4 get_splits() {
+        return splits;
+    }
+};
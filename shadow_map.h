@@ -1,56 +1,123 @@
 #pragma once
+#include <vector>
 #include <GL/glew.h>
+#include "gl_state.h"
+#include "profiler.h"
 
 
+// Depth texture array with a framebuffer per layer, sampled with depth comparison
+// (sampler2DArrayShadow), so lookups are filtered over the 2x2 nearest texels.
 class Shadow_map {
 
+    public:
+
+    static constexpr int size = 1024;
+
     private:
 
     GLuint texture_id;
     GLuint buffer_id;
-    int width = 1024;
-    int height = 1024;
+    std::vector<GLuint> layer_buffers;
+    int width;
+    int height;
 
     public:
 
-    Shadow_map() {
+    Shadow_map(int layers = 1, int resolution = size)
+      : layer_buffers(layers)
+      , width(resolution)
+      , height(resolution)
+    {
         glGenTextures(1, &texture_id);
-        glBindTexture(GL_TEXTURE_2D, texture_id);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, width, height, 0,
+        get_gl_state().bind_texture(GL_TEXTURE_2D_ARRAY, texture_id);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, width, height, layers, 0,
                      GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR); 
-        glBindTexture(GL_TEXTURE_2D, 0);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+        // All the layers, to clear them at once.
         glGenFramebuffers(1, &buffer_id);
         glBindFramebuffer(GL_FRAMEBUFFER, buffer_id);
         glDrawBuffer(GL_NONE);
         glReadBuffer(GL_NONE);
         glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture_id, 0);
+
+        glGenFramebuffers(layers, layer_buffers.data());
+        for (int layer = 0; layer < layers; layer++) {
+            glBindFramebuffer(GL_FRAMEBUFFER, layer_buffers[layer]);
+            glDrawBuffer(GL_NONE);
+            glReadBuffer(GL_NONE);
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture_id, 0, layer);
+        }
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
     }
 
+    ~Shadow_map() {
+        glDeleteFramebuffers(layer_buffers.size(), layer_buffers.data());
+        glDeleteFramebuffers(1, &buffer_id);
+        glDeleteTextures(1, &texture_id);
+        get_gl_state().forget_texture(texture_id);
+    }
+
+    Shadow_map(const Shadow_map&) = delete;
+    Shadow_map& operator=(const Shadow_map&) = delete;
+
     GLuint get_id() {
-        return texture_id; 
+        return texture_id;
     }
 
-    template<class U, class V>
-    void render(
-        shader_t shadow_shader,
-        U obj1,
-        V obj2,
-        glm::mat4 mvp1,
-        glm::mat4 mvp2
-    ) {
+    int get_layers_count() {
+        return layer_buffers.size();
+    }
+
+    // Binds the depth texture for sampling; returns its unit.
+    GLint bind() {
+        return get_gl_state().bind_texture(GL_TEXTURE_2D_ARRAY, texture_id);
+    }
+
+    // Binds all the layers; drawing goes to the first one, clearing to all of them.
+    void bind_framebuffer() {
         glBindFramebuffer(GL_FRAMEBUFFER, buffer_id);
         glViewport(0, 0, width, height);
-        glClear(GL_DEPTH_BUFFER_BIT);
+    }
+
+    void bind_layer(int layer) {
+        glBindFramebuffer(GL_FRAMEBUFFER, layer_buffers[layer]);
+        glViewport(0, 0, width, height);
+    }
+
+    // Copies a layer of another map of the same size into a layer of this one, and
+    // leaves that layer bound.
+    void copy_layer(Shadow_map& source, int source_layer, int layer) {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, source.layer_buffers[source_layer]);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, layer_buffers[layer]);
+        glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        bind_layer(layer);
+    }
+
+    // Draws into the bound framebuffer, see bind_layer.
+    template<class U>
+    void render(shader_t& shadow_shader, U& obj, const glm::mat4& mvp) {
+        PROFILE_ZONE("Shadow_map::render");
         shadow_shader.use();
-        shadow_shader.set_uniform("mvp", glm::value_ptr(mvp1));
-        obj1.render();
-        shadow_shader.set_uniform("mvp", glm::value_ptr(mvp2));
-        obj2.render();
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        glActiveTexture(GL_TEXTURE0 + texture_id);
-        glBindTexture(GL_TEXTURE_2D, texture_id);
+        shadow_shader.set_uniform("mvp", glm::value_ptr(mvp));
+        obj.render_depth(shadow_shader, mvp);
+    }
+
+    template<class U, class V>
+    void render(
+        shader_t& shadow_shader,
+        U& obj1,
+        V& obj2,
+        const glm::mat4& mvp1,
+        const glm::mat4& mvp2
+    ) {
+        render(shadow_shader, obj1, mvp1);
+        render(shadow_shader, obj2, mvp2);
     }
 
-};
\ No newline at end of file
+};
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include "map.h"
+#include "triple_buffer.h"
+
+
+// Advances the map state on its own thread at a fixed tick, independent of the
+// frame rate. Each tick publishes the two latest states; the renderer draws
+// in between them, one tick behind the simulation. Without a thread the ticks
+// are run by advance() up to a given time instead, which makes replays exact.
+class Simulation {
+
+    typedef std::chrono::steady_clock Clock;
+
+    private:
+
+    struct Snapshot {
+        Map::State previous;
+        Map::State current;
+        Clock::time_point time;
+        Clock::duration tick;
+    };
+
+    TripleBuffer<Snapshot> snapshots;
+    TripleBuffer<Map::Input> inputs;
+
+    std::atomic<int64_t> tick_ns;
+    std::atomic<bool> running { true };
+    std::thread thread;
+
+    // State of the simulation without a thread.
+    Map::State state;
+    Map::Input input;
+    Clock::time_point next;
+
+    // After a stall longer than this the lost ticks are dropped instead of caught up.
+    static constexpr std::chrono::milliseconds max_lag { 250 };
+
+    // Runs the tick at next and moves next one tick on.
+    void step() {
+        inputs.read(input);
+        Clock::duration tick = std::chrono::nanoseconds(tick_ns.load(std::memory_order_relaxed));
+
+        Snapshot snapshot;
+        snapshot.previous = state;
+        state = Map::step(state, input, std::chrono::duration<float>(tick).count());
+        snapshot.current = state;
+        snapshot.time = next;
+        snapshot.tick = tick;
+        snapshots.write(snapshot);
+
+        next += tick;
+    }
+
+    void run() {
+        Profiler::set_thread_name("simulation");
+        while (running.load(std::memory_order_relaxed)) {
+            step();
+            if (Clock::now() - next > max_lag) {
+                next = Clock::now();
+            }
+            std::this_thread::sleep_until(next);
+        }
+    }
+
+    public:
+
+    // Threaded simulations start at once; others run ticks from start on in advance().
+    Simulation(const Map::State& initial, std::chrono::nanoseconds tick, bool threaded = true, Clock::time_point start = Clock::now())
+      : snapshots(Snapshot { initial, initial, start, tick })
+      , inputs(Map::Input { 0, 0, initial.grid_size })
+      , tick_ns(tick.count())
+      , state(initial)
+      , input(Map::Input { 0, 0, initial.grid_size })
+      , next(start)
+    {
+        if (threaded) {
+            thread = std::thread(&Simulation::run, this);
+        }
+    }
+
+    ~Simulation() {
+        running = false;
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+
+    // Runs the ticks up to now; only for simulations without a thread.
+    void advance(Clock::time_point now) {
+        while (next <= now) {
+            step();
+        }
+    }
+
+    Simulation(const Simulation&) = delete;
+    Simulation& operator=(const Simulation&) = delete;
+
+    void set_input(const Map::Input& input) {
+        inputs.write(input);
+    }
+
+    void set_tick(std::chrono::nanoseconds tick) {
+        tick_ns = std::max<int64_t>(tick.count(), 1);
+    }
+
+    // The state at now minus one tick, interpolated between the last two ticks.
+    Map::State get_state(Clock::time_point now) {
+        Snapshot snapshot;
+        snapshots.read(snapshot);
+
+        float t = std::chrono::duration<float>(now - snapshot.time) / snapshot.tick;
+        return Map::interpolate(snapshot.previous, snapshot.current, std::clamp(t, 0.f, 1.f));
+    }
+};
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <mutex>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "agents.h"
+#include "thread_pool.h"
+
+
+// Uniform grid of buckets over the wrapped (i, j) torus grid, rebuilt from the
+// agents each step with a counting sort. Distances are measured the short way
+// around the torus.
+class SpatialHash {
+
+    private:
+
+    glm::vec2 grid_size;
+    int cells[2];
+    float cell_size[2];
+
+    std::vector<uint32_t> cell_of;
+    // Agents of cell c are entries[cell_start[c], cell_start[c + 1]), with their positions.
+    std::vector<uint32_t> cell_start;
+    std::vector<uint32_t> entries;
+    std::vector<float> entry_i;
+    std::vector<float> entry_j;
+
+    int get_cell(float p, int axis) const {
+        return std::min(int(p / cell_size[axis]), cells[axis] - 1);
+    }
+
+    static int wrap(int c, int count) {
+        c %= count;
+        return c < 0 ? c + count : c;
+    }
+
+    // Offset from a to b along one axis through the shorter way round.
+    static float get_offset(float a, float b, float size) {
+        float d = b - a;
+        if (d > size / 2) {
+            d -= size;
+        } else if (d < -size / 2) {
+            d += size;
+        }
+        return d;
+    }
+
+    public:
+
+    // Cells are at least cell_size grid cells wide; queries are cheapest with a
+    // radius up to the cell size.
+    SpatialHash(const glm::vec2& grid_size, float min_cell_size) : grid_size(grid_size) {
+        for (int axis = 0; axis < 2; axis++) {
+            cells[axis] = std::max(int(grid_size[axis] / min_cell_size), 1);
+            cell_size[axis] = grid_size[axis] / cells[axis];
+        }
+        cell_start.assign(cells[0] * cells[1] + 1, 0);
+    }
+
+    void build(const Agents& agents, ThreadPool& pool) {
+        size_t count = agents.size();
+        const float* i = agents.get_i();
+        const float* j = agents.get_j();
+
+        cell_of.resize(count);
+        pool.parallel_for(0, count, [&](size_t from, size_t to) {
+            for (size_t k = from; k < to; k++) {
+                cell_of[k] = get_cell(i[k], 0) * cells[1] + get_cell(j[k], 1);
+            }
+        });
+
+        std::fill(cell_start.begin(), cell_start.end(), 0);
+        for (size_t k = 0; k < count; k++) {
+            cell_start[cell_of[k] + 1]++;
+        }
+        for (size_t c = 1; c < cell_start.size(); c++) {
+            cell_start[c] += cell_start[c - 1];
+        }
+
+        entries.resize(count);
+        entry_i.resize(count);
+        entry_j.resize(count);
+        std::vector<uint32_t> filled(cell_start.begin(), cell_start.end() - 1);
+        for (size_t k = 0; k < count; k++) {
+            uint32_t e = filled[cell_of[k]]++;
+            entries[e] = k;
+            entry_i[e] = i[k];
+            entry_j[e] = j[k];
+        }
+    }
+
+    // Calls f(agent, offset) for every agent within radius of p, offset pointing
+    // from p to the agent.
+    template<class F>
+    void for_each_neighbour(const glm::vec2& p, float radius, F&& f) const {
+        int first[2];
+        int span[2];
+        for (int axis = 0; axis < 2; axis++) {
+            int reach = (int) std::ceil(radius / cell_size[axis]);
+            // Cells past the whole grid would be visited twice.
+            span[axis] = std::min(2 * reach + 1, cells[axis]);
+            first[axis] = get_cell(p[axis], axis) - std::min(reach, (cells[axis] - 1) / 2);
+        }
+        float radius2 = radius * radius;
+
+        for (int a = 0; a < span[0]; a++) {
+            int ci = wrap(first[0] + a, cells[0]);
+            for (int b = 0; b < span[1]; b++) {
+                int c = ci * cells[1] + wrap(first[1] + b, cells[1]);
+                for (uint32_t e = cell_start[c]; e < cell_start[c + 1]; e++) {
+                    glm::vec2 offset(
+                        get_offset(p[0], entry_i[e], grid_size[0]),
+                        get_offset(p[1], entry_j[e], grid_size[1])
+                    );
+                    if (glm::dot(offset, offset) <= radius2) {
+                        f(entries[e], offset);
+                    }
+                }
+            }
+        }
+    }
+
+    std::vector<uint32_t> get_neighbours(const glm::vec2& p, float radius) const {
+        std::vector<uint32_t> result;
+        for_each_neighbour(p, radius, [&result](uint32_t agent, const glm::vec2&) {
+            result.push_back(agent);
+        });
+        return result;
+    }
+
+    // Every pair of agents closer than radius, each pair once with the lower index first.
+    std::vector<std::pair<uint32_t, uint32_t>> find_collisions(const Agents& agents, float radius, ThreadPool& pool) const {
+        std::vector<std::pair<uint32_t, uint32_t>> result;
+        std::mutex result_mutex;
+
+        pool.parallel_for(0, agents.size(), [&](size_t from, size_t to) {
+            std::vector<std::pair<uint32_t, uint32_t>> pairs;
+            for (size_t k = from; k < to; k++) {
+                for_each_neighbour(agents.get_position(k), radius, [&pairs, k](uint32_t other, const glm::vec2&) {
+                    if (other > k) {
+                        pairs.emplace_back(k, other);
+                    }
+                });
+            }
+
+            std::lock_guard<std::mutex> lock(result_mutex);
+            result.insert(result.end(), pairs.begin(), pairs.end());
+        });
+
+        return result;
+    }
+};
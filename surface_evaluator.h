@@ -0,0 +1,513 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <glm/glm.hpp>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SURFACE_EVALUATOR_SSE2
+#endif
+
+
+// Everything per-frame placement needs about one point of the surface.
+struct SurfaceSample {
+    glm::vec3 position;
+    glm::vec3 normal;
+    // Derivatives of the position along i and j, per grid step.
+    glm::vec3 tangent_i;
+    glm::vec3 tangent_j;
+    // Frame at the point: x along the outward direction of the torus without heights,
+    // y along growing i, z along growing j, origin at position.
+    glm::mat4 placement;
+};
+
+
+// Evaluates torus surface points for grid coordinates (i, j).
+// phi depends only on the row i and psi only on the column j, so their
+// sin/cos are tabulated once per grid; fractional coordinates are resolved
+// with the angle addition formulas and a short polynomial for the remainder.
+class SurfaceEvaluator {
+
+    private:
+
+    float R;
+    float r;
+
+    size_t x_count;
+    size_t y_count;
+
+    float phi_step;
+    float psi_step;
+
+    std::vector<float> cos_phi;
+    std::vector<float> sin_phi;
+    std::vector<float> cos_psi;
+    std::vector<float> sin_psi;
+
+    // Mirrors the wraparound rules of the grid: one period back for negative
+    // coordinates, and the last row/column (and everything past it) maps to 0.
+    static void reduce(float t, size_t count, int& index, float& frac) {
+        float period = count - 1;
+        if (t < 0) {
+            t += period;
+        }
+        if (t >= period || t < 0) {
+            t = 0;
+        }
+        index = (int) t;
+        frac = t - index;
+    }
+
+    static void rotate(float c, float s, float d, float& out_c, float& out_s) {
+        float d2 = d * d;
+        float cd = 1 - d2 * (1.f / 2 - d2 * (1.f / 24 - d2 * (1.f / 720)));
+        float sd = d * (1 - d2 * (1.f / 6 - d2 * (1.f / 120 - d2 * (1.f / 5040))));
+        out_c = c * cd - s * sd;
+        out_s = s * cd + c * sd;
+    }
+
+    void get_trig(float i, float j, float& cphi, float& sphi, float& cpsi, float& spsi) const {
+        int ki, kj;
+        float fi, fj;
+        reduce(i, y_count, ki, fi);
+        reduce(j, x_count, kj, fj);
+
+        rotate(cos_phi[ki], sin_phi[ki], fi * phi_step, cphi, sphi);
+        rotate(cos_psi[kj], sin_psi[kj], fj * psi_step, cpsi, spsi);
+    }
+
+    // Partial derivatives of the surface along i and j, with the height changing
+    // by dh_di and dh_dj per grid step.
+    void get_derivatives(
+        float cphi,
+        float sphi,
+        float cpsi,
+        float spsi,
+        float h,
+        float dh_di,
+        float dh_dj,
+        glm::vec3& d_i,
+        glm::vec3& d_j
+    ) const {
+        float rho = r + h;
+        float ring = R + rho * cpsi;
+        glm::vec3 d_rho(cpsi * cphi, cpsi * sphi, spsi);
+        d_i = glm::vec3(-ring * sphi, ring * cphi, 0) * phi_step + d_rho * dh_di;
+        d_j = glm::vec3(-rho * spsi * cphi, -rho * spsi * sphi, rho * cpsi) * psi_step + d_rho * dh_dj;
+    }
+
+    glm::vec3 get_normal(float cphi, float sphi, float cpsi, float spsi, float h, float dh_di, float dh_dj) const {
+        glm::vec3 d_i, d_j;
+        get_derivatives(cphi, sphi, cpsi, spsi, h, dh_di, dh_dj, d_i, d_j);
+        return glm::normalize(glm::cross(d_i, d_j));
+    }
+
+#if defined(__AVX2__)
+    static void reduce(__m256 t, float count, __m256i& index, __m256& frac) {
+        __m256 period = _mm256_set1_ps(count - 1);
+        __m256 zero = _mm256_setzero_ps();
+        t = _mm256_add_ps(t, _mm256_and_ps(_mm256_cmp_ps(t, zero, _CMP_LT_OQ), period));
+        __m256 outside = _mm256_or_ps(
+            _mm256_cmp_ps(t, period, _CMP_GE_OQ),
+            _mm256_cmp_ps(t, zero, _CMP_LT_OQ)
+        );
+        t = _mm256_andnot_ps(outside, t);
+        __m256 floor = _mm256_floor_ps(t);
+        index = _mm256_cvttps_epi32(floor);
+        frac = _mm256_sub_ps(t, floor);
+    }
+
+    static void rotate(__m256 c, __m256 s, __m256 d, __m256& out_c, __m256& out_s) {
+        __m256 d2 = _mm256_mul_ps(d, d);
+        __m256 one = _mm256_set1_ps(1.f);
+        __m256 cd = _mm256_sub_ps(_mm256_set1_ps(1.f / 24), _mm256_mul_ps(d2, _mm256_set1_ps(1.f / 720)));
+        cd = _mm256_sub_ps(_mm256_set1_ps(1.f / 2), _mm256_mul_ps(d2, cd));
+        cd = _mm256_sub_ps(one, _mm256_mul_ps(d2, cd));
+        __m256 sd = _mm256_sub_ps(_mm256_set1_ps(1.f / 120), _mm256_mul_ps(d2, _mm256_set1_ps(1.f / 5040)));
+        sd = _mm256_sub_ps(_mm256_set1_ps(1.f / 6), _mm256_mul_ps(d2, sd));
+        sd = _mm256_mul_ps(d, _mm256_sub_ps(one, _mm256_mul_ps(d2, sd)));
+        out_c = _mm256_sub_ps(_mm256_mul_ps(c, cd), _mm256_mul_ps(s, sd));
+        out_s = _mm256_add_ps(_mm256_mul_ps(s, cd), _mm256_mul_ps(c, sd));
+    }
+#elif defined(SURFACE_EVALUATOR_SSE2)
+    // SSE2 has no floor, but t is not negative once reduced, so truncation does.
+    static void reduce(__m128 t, float count, __m128i& index, __m128& frac) {
+        __m128 period = _mm_set1_ps(count - 1);
+        __m128 zero = _mm_setzero_ps();
+        t = _mm_add_ps(t, _mm_and_ps(_mm_cmplt_ps(t, zero), period));
+        __m128 outside = _mm_or_ps(_mm_cmpge_ps(t, period), _mm_cmplt_ps(t, zero));
+        t = _mm_andnot_ps(outside, t);
+        index = _mm_cvttps_epi32(t);
+        frac = _mm_sub_ps(t, _mm_cvtepi32_ps(index));
+    }
+
+    static void rotate(__m128 c, __m128 s, __m128 d, __m128& out_c, __m128& out_s) {
+        __m128 d2 = _mm_mul_ps(d, d);
+        __m128 one = _mm_set1_ps(1.f);
+        __m128 cd = _mm_sub_ps(_mm_set1_ps(1.f / 24), _mm_mul_ps(d2, _mm_set1_ps(1.f / 720)));
+        cd = _mm_sub_ps(_mm_set1_ps(1.f / 2), _mm_mul_ps(d2, cd));
+        cd = _mm_sub_ps(one, _mm_mul_ps(d2, cd));
+        __m128 sd = _mm_sub_ps(_mm_set1_ps(1.f / 120), _mm_mul_ps(d2, _mm_set1_ps(1.f / 5040)));
+        sd = _mm_sub_ps(_mm_set1_ps(1.f / 6), _mm_mul_ps(d2, sd));
+        sd = _mm_mul_ps(d, _mm_sub_ps(one, _mm_mul_ps(d2, sd)));
+        out_c = _mm_sub_ps(_mm_mul_ps(c, cd), _mm_mul_ps(s, sd));
+        out_s = _mm_add_ps(_mm_mul_ps(s, cd), _mm_mul_ps(c, sd));
+    }
+
+    // Four table entries; SSE2 has no gather.
+    static __m128 gather(const std::vector<float>& table, const int* index) {
+        return _mm_setr_ps(table[index[0]], table[index[1]], table[index[2]], table[index[3]]);
+    }
+#endif
+
+    public:
+
+    SurfaceEvaluator(float R, float r, size_t x_count, size_t y_count)
+      : R(R)
+      , r(r)
+      , x_count(x_count)
+      , y_count(y_count)
+      , phi_step(2 * M_PI / (y_count - 1))
+      , psi_step(2 * M_PI / (x_count - 1))
+      , cos_phi(y_count)
+      , sin_phi(y_count)
+      , cos_psi(x_count)
+      , sin_psi(x_count)
+    {
+        for (size_t i = 0; i < y_count; i++) {
+            float phi = i >= y_count - 1 ? 0 : 2 * M_PI / (y_count - 1) * i;
+            cos_phi[i] = cos(phi);
+            sin_phi[i] = sin(phi);
+        }
+        for (size_t j = 0; j < x_count; j++) {
+            float psi = j >= x_count - 1 ? -M_PI : 2 * M_PI / (x_count - 1) * j - M_PI;
+            cos_psi[j] = cos(psi);
+            sin_psi[j] = sin(psi);
+        }
+    }
+
+    glm::vec3 get_vertex(size_t i, size_t j, float h) const {
+        float rho = r + h;
+        float ring = R + rho * cos_psi[j];
+        return { ring * cos_phi[i], ring * sin_phi[i], rho * sin_psi[j] };
+    }
+
+    glm::vec3 get_vertex(float i, float j, float h) const {
+        float cphi, sphi, cpsi, spsi;
+        get_trig(i, j, cphi, sphi, cpsi, spsi);
+
+        float rho = r + h;
+        float ring = R + rho * cpsi;
+        return { ring * cphi, ring * sphi, rho * spsi };
+    }
+
+    glm::vec3 get_normal(size_t i, size_t j, float h, float dh_di, float dh_dj) const {
+        return get_normal(cos_phi[i], sin_phi[i], cos_psi[j], sin_psi[j], h, dh_di, dh_dj);
+    }
+
+    glm::vec3 get_normal(float i, float j, float h, float dh_di, float dh_dj) const {
+        float cphi, sphi, cpsi, spsi;
+        get_trig(i, j, cphi, sphi, cpsi, spsi);
+        return get_normal(cphi, sphi, cpsi, spsi, h, dh_di, dh_dj);
+    }
+
+    // Position, normal, tangents and placement frame from one evaluation of the angles.
+    SurfaceSample sample(float i, float j, float h, float dh_di, float dh_dj) const {
+        float cphi, sphi, cpsi, spsi;
+        get_trig(i, j, cphi, sphi, cpsi, spsi);
+
+        float rho = r + h;
+        float ring = R + rho * cpsi;
+
+        SurfaceSample result;
+        result.position = glm::vec3(ring * cphi, ring * sphi, rho * spsi);
+        get_derivatives(cphi, sphi, cpsi, spsi, h, dh_di, dh_dj, result.tangent_i, result.tangent_j);
+        result.normal = glm::normalize(glm::cross(result.tangent_i, result.tangent_j));
+        result.placement = glm::mat4(
+            glm::vec4(cpsi * cphi, cpsi * sphi, spsi, 0),
+            glm::vec4(-sphi, cphi, 0, 0),
+            glm::vec4(-spsi * cphi, -spsi * sphi, cpsi, 0),
+            glm::vec4(result.position, 1)
+        );
+        return result;
+    }
+
+    // sample() for count points: positions and angles from one evaluate() pass, the
+    // tangents and normals as plain per-point arithmetic over the arrays, left to the
+    // compiler to vectorize, then the samples are filled in.
+    void sample(
+        const float* i,
+        const float* j,
+        const float* heights,
+        const float* dh_di,
+        const float* dh_dj,
+        size_t count,
+        SurfaceSample* result
+    ) const {
+        std::vector<float> buffer(count * 16);
+        float* x = buffer.data();
+        float* y = x + count;
+        float* z = y + count;
+        float* cphi = z + count;
+        float* sphi = cphi + count;
+        float* cpsi = sphi + count;
+        float* spsi = cpsi + count;
+        float* ix = spsi + count;
+        float* iy = ix + count;
+        float* iz = iy + count;
+        float* jx = iz + count;
+        float* jy = jx + count;
+        float* jz = jy + count;
+        float* nx = jz + count;
+        float* ny = nx + count;
+        float* nz = ny + count;
+
+        evaluate(i, j, heights, count, x, y, z, cphi);
+
+        for (size_t k = 0; k < count; k++) {
+            float rho = r + heights[k];
+            float ring = R + rho * cpsi[k];
+
+            float rx = cpsi[k] * cphi[k];
+            float ry = cpsi[k] * sphi[k];
+            float rz = spsi[k];
+
+            ix[k] = -ring * sphi[k] * phi_step + rx * dh_di[k];
+            iy[k] = ring * cphi[k] * phi_step + ry * dh_di[k];
+            iz[k] = rz * dh_di[k];
+
+            jx[k] = -rho * spsi[k] * cphi[k] * psi_step + rx * dh_dj[k];
+            jy[k] = -rho * spsi[k] * sphi[k] * psi_step + ry * dh_dj[k];
+            jz[k] = rho * cpsi[k] * psi_step + rz * dh_dj[k];
+
+            float cx = iy[k] * jz[k] - iz[k] * jy[k];
+            float cy = iz[k] * jx[k] - ix[k] * jz[k];
+            float cz = ix[k] * jy[k] - iy[k] * jx[k];
+            float scale = 1 / std::sqrt(cx * cx + cy * cy + cz * cz);
+
+            nx[k] = cx * scale;
+            ny[k] = cy * scale;
+            nz[k] = cz * scale;
+        }
+
+        for (size_t k = 0; k < count; k++) {
+            SurfaceSample& s = result[k];
+            s.position = glm::vec3(x[k], y[k], z[k]);
+            s.normal = glm::vec3(nx[k], ny[k], nz[k]);
+            s.tangent_i = glm::vec3(ix[k], iy[k], iz[k]);
+            s.tangent_j = glm::vec3(jx[k], jy[k], jz[k]);
+            s.placement = glm::mat4(
+                glm::vec4(cpsi[k] * cphi[k], cpsi[k] * sphi[k], spsi[k], 0),
+                glm::vec4(-sphi[k], cphi[k], 0, 0),
+                glm::vec4(-spsi[k] * cphi[k], -spsi[k] * sphi[k], cpsi[k], 0),
+                glm::vec4(s.position, 1)
+            );
+        }
+    }
+
+    // Integer row i, columns [j_begin, j_begin + count), heights per column.
+    void evaluate_row(
+        size_t i,
+        size_t j_begin,
+        size_t count,
+        const float* heights,
+        float* x,
+        float* y,
+        float* z
+    ) const {
+        const float* cpsi = &cos_psi[j_begin];
+        const float* spsi = &sin_psi[j_begin];
+        float cphi = cos_phi[i];
+        float sphi = sin_phi[i];
+
+        size_t k = 0;
+
+#if defined(__AVX2__)
+        __m256 v_R = _mm256_set1_ps(R);
+        __m256 v_r = _mm256_set1_ps(r);
+        __m256 v_cphi = _mm256_set1_ps(cphi);
+        __m256 v_sphi = _mm256_set1_ps(sphi);
+        for (; k + 8 <= count; k += 8) {
+            __m256 rho = _mm256_add_ps(v_r, _mm256_loadu_ps(heights + k));
+            __m256 ring = _mm256_add_ps(v_R, _mm256_mul_ps(rho, _mm256_loadu_ps(cpsi + k)));
+            _mm256_storeu_ps(x + k, _mm256_mul_ps(ring, v_cphi));
+            _mm256_storeu_ps(y + k, _mm256_mul_ps(ring, v_sphi));
+            _mm256_storeu_ps(z + k, _mm256_mul_ps(rho, _mm256_loadu_ps(spsi + k)));
+        }
+#elif defined(SURFACE_EVALUATOR_SSE2)
+        __m128 v_R = _mm_set1_ps(R);
+        __m128 v_r = _mm_set1_ps(r);
+        __m128 v_cphi = _mm_set1_ps(cphi);
+        __m128 v_sphi = _mm_set1_ps(sphi);
+        for (; k + 4 <= count; k += 4) {
+            __m128 rho = _mm_add_ps(v_r, _mm_loadu_ps(heights + k));
+            __m128 ring = _mm_add_ps(v_R, _mm_mul_ps(rho, _mm_loadu_ps(cpsi + k)));
+            _mm_storeu_ps(x + k, _mm_mul_ps(ring, v_cphi));
+            _mm_storeu_ps(y + k, _mm_mul_ps(ring, v_sphi));
+            _mm_storeu_ps(z + k, _mm_mul_ps(rho, _mm_loadu_ps(spsi + k)));
+        }
+#endif
+
+        for (; k < count; k++) {
+            float rho = r + heights[k];
+            float ring = R + rho * cpsi[k];
+            x[k] = ring * cphi;
+            y[k] = ring * sphi;
+            z[k] = rho * spsi[k];
+        }
+    }
+
+    // Normals of integer row i, columns [j_begin, j_begin + count), with heights and
+    // height gradients per column. Plain per-column arithmetic, left to the compiler
+    // to vectorize.
+    void evaluate_normals_row(
+        size_t i,
+        size_t j_begin,
+        size_t count,
+        const float* heights,
+        const float* dh_di,
+        const float* dh_dj,
+        float* nx,
+        float* ny,
+        float* nz
+    ) const {
+        const float* cpsi = &cos_psi[j_begin];
+        const float* spsi = &sin_psi[j_begin];
+        float cphi = cos_phi[i];
+        float sphi = sin_phi[i];
+
+        for (size_t k = 0; k < count; k++) {
+            float rho = r + heights[k];
+            float ring = R + rho * cpsi[k];
+
+            float rx = cpsi[k] * cphi;
+            float ry = cpsi[k] * sphi;
+            float rz = spsi[k];
+
+            float ix = -ring * sphi * phi_step + rx * dh_di[k];
+            float iy = ring * cphi * phi_step + ry * dh_di[k];
+            float iz = rz * dh_di[k];
+
+            float jx = -rho * spsi[k] * cphi * psi_step + rx * dh_dj[k];
+            float jy = -rho * spsi[k] * sphi * psi_step + ry * dh_dj[k];
+            float jz = rho * cpsi[k] * psi_step + rz * dh_dj[k];
+
+            float x = iy * jz - iz * jy;
+            float y = iz * jx - ix * jz;
+            float z = ix * jy - iy * jx;
+            float scale = 1 / std::sqrt(x * x + y * y + z * z);
+
+            nx[k] = x * scale;
+            ny[k] = y * scale;
+            nz[k] = z * scale;
+        }
+    }
+
+    // Arbitrary fractional (i, j) points, structure-of-arrays in and out. With angles,
+    // cos phi, sin phi, cos psi and sin psi of the points go there too, count of each.
+    void evaluate(
+        const float* i,
+        const float* j,
+        const float* heights,
+        size_t count,
+        float* x,
+        float* y,
+        float* z,
+        float* angles = nullptr
+    ) const {
+        size_t k = 0;
+
+#if defined(__AVX2__)
+        __m256 v_R = _mm256_set1_ps(R);
+        __m256 v_r = _mm256_set1_ps(r);
+        __m256 v_phi_step = _mm256_set1_ps(phi_step);
+        __m256 v_psi_step = _mm256_set1_ps(psi_step);
+        for (; k + 8 <= count; k += 8) {
+            __m256i ki, kj;
+            __m256 fi, fj;
+            reduce(_mm256_loadu_ps(i + k), y_count, ki, fi);
+            reduce(_mm256_loadu_ps(j + k), x_count, kj, fj);
+
+            __m256 cphi, sphi, cpsi, spsi;
+            rotate(
+                _mm256_i32gather_ps(cos_phi.data(), ki, 4),
+                _mm256_i32gather_ps(sin_phi.data(), ki, 4),
+                _mm256_mul_ps(fi, v_phi_step),
+                cphi,
+                sphi
+            );
+            rotate(
+                _mm256_i32gather_ps(cos_psi.data(), kj, 4),
+                _mm256_i32gather_ps(sin_psi.data(), kj, 4),
+                _mm256_mul_ps(fj, v_psi_step),
+                cpsi,
+                spsi
+            );
+
+            __m256 rho = _mm256_add_ps(v_r, _mm256_loadu_ps(heights + k));
+            __m256 ring = _mm256_add_ps(v_R, _mm256_mul_ps(rho, cpsi));
+            _mm256_storeu_ps(x + k, _mm256_mul_ps(ring, cphi));
+            _mm256_storeu_ps(y + k, _mm256_mul_ps(ring, sphi));
+            _mm256_storeu_ps(z + k, _mm256_mul_ps(rho, spsi));
+            if (angles) {
+                _mm256_storeu_ps(angles + k, cphi);
+                _mm256_storeu_ps(angles + count + k, sphi);
+                _mm256_storeu_ps(angles + 2 * count + k, cpsi);
+                _mm256_storeu_ps(angles + 3 * count + k, spsi);
+            }
+        }
+#elif defined(SURFACE_EVALUATOR_SSE2)
+        __m128 v_R = _mm_set1_ps(R);
+        __m128 v_r = _mm_set1_ps(r);
+        __m128 v_phi_step = _mm_set1_ps(phi_step);
+        __m128 v_psi_step = _mm_set1_ps(psi_step);
+        for (; k + 4 <= count; k += 4) {
+            __m128i ki, kj;
+            __m128 fi, fj;
+            reduce(_mm_loadu_ps(i + k), y_count, ki, fi);
+            reduce(_mm_loadu_ps(j + k), x_count, kj, fj);
+
+            alignas(16) int ii[4];
+            alignas(16) int jj[4];
+            _mm_store_si128(reinterpret_cast<__m128i*>(ii), ki);
+            _mm_store_si128(reinterpret_cast<__m128i*>(jj), kj);
+
+            __m128 cphi, sphi, cpsi, spsi;
+            rotate(gather(cos_phi, ii), gather(sin_phi, ii), _mm_mul_ps(fi, v_phi_step), cphi, sphi);
+            rotate(gather(cos_psi, jj), gather(sin_psi, jj), _mm_mul_ps(fj, v_psi_step), cpsi, spsi);
+
+            __m128 rho = _mm_add_ps(v_r, _mm_loadu_ps(heights + k));
+            __m128 ring = _mm_add_ps(v_R, _mm_mul_ps(rho, cpsi));
+            _mm_storeu_ps(x + k, _mm_mul_ps(ring, cphi));
+            _mm_storeu_ps(y + k, _mm_mul_ps(ring, sphi));
+            _mm_storeu_ps(z + k, _mm_mul_ps(rho, spsi));
+            if (angles) {
+                _mm_storeu_ps(angles + k, cphi);
+                _mm_storeu_ps(angles + count + k, sphi);
+                _mm_storeu_ps(angles + 2 * count + k, cpsi);
+                _mm_storeu_ps(angles + 3 * count + k, spsi);
+            }
+        }
+#endif
+
+        for (; k < count; k++) {
+            float cphi, sphi, cpsi, spsi;
+            get_trig(i[k], j[k], cphi, sphi, cpsi, spsi);
+
+            float rho = r + heights[k];
+            float ring = R + rho * cpsi;
+            x[k] = ring * cphi;
+            y[k] = ring * sphi;
+            z[k] = rho * spsi;
+            if (angles) {
+                angles[k] = cphi;
+                angles[count + k] = sphi;
+                angles[2 * count + k] = cpsi;
+                angles[3 * count + k] = spsi;
+            }
+        }
+    }
+};
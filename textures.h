@@ -2,6 +2,7 @@
 #include <string>
 #include <array>
 #include <GL/glew.h>
+#include "gl_state.h"
 #include <stdexcept>
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -20,7 +21,7 @@ class Texture {
         unsigned char *data= stbi_load(file.c_str(), &width, &height, &nrChannels, STBI_rgb);
 
         glGenTextures(1, &texture_id);
-        glBindTexture(GL_TEXTURE_2D, texture_id);
+        get_gl_state().bind_texture(GL_TEXTURE_2D, texture_id);
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR); // important
         glGenerateMipmap(GL_TEXTURE_2D);
@@ -32,6 +33,11 @@ class Texture {
         return texture_id; 
     }
 
+    // Binds the texture for sampling; returns its unit.
+    GLint bind() {
+        return get_gl_state().bind_texture(GL_TEXTURE_2D, texture_id);
+    }
+
 };
 	
 
@@ -47,7 +53,7 @@ class CubemapTextureLoader {
 
         GLuint texture_id;
         glGenTextures(1, &texture_id);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, texture_id);
+        get_gl_state().bind_texture(GL_TEXTURE_CUBE_MAP, texture_id);
 
         int width, height, nrChannels;
         unsigned char *data; 
@@ -91,8 +97,10 @@ class TextureLoader {
         unsigned char *data= stbi_load(file.c_str(), &width, &height, &nrChannels, STBI_rgb);
 
         glGenTextures(1, &texture_id);
-        glBindTexture(GL_TEXTURE_2D, texture_id);
+        get_gl_state().bind_texture(GL_TEXTURE_2D, texture_id);
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glGenerateMipmap(GL_TEXTURE_2D);
 
         stbi_image_free(data);
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include "parallel.h"
+
+
+// Fixed set of worker threads taking tasks from a shared queue, for work submitted
+// often enough that starting threads each time (as parallel_for does) would show.
+class ThreadPool {
+
+    private:
+
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable available;
+    bool stopping = false;
+
+    void work() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                available.wait(lock, [this]() { return stopping || !tasks.empty(); });
+                if (tasks.empty()) {
+                    return;
+                }
+                task = std::move(tasks.front());
+                tasks.pop();
+            }
+            task();
+        }
+    }
+
+    public:
+
+    ThreadPool(size_t threads_count = get_threads_count()) {
+        for (size_t k = 0; k < threads_count; k++) {
+            workers.emplace_back(&ThreadPool::work, this);
+        }
+    }
+
+    // Finishes the queued tasks first.
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        available.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const {
+        return workers.size();
+    }
+
+    template<class F>
+    std::future<decltype(std::declval<F>()())> submit(F&& f) {
+        using Result = decltype(std::declval<F>()());
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(f));
+        std::future<Result> result = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.emplace([task]() { (*task)(); });
+        }
+        available.notify_one();
+        return result;
+    }
+
+    // Like parallel_for, on the pool: f(range_begin, range_end) for about
+    // chunks_per_thread ranges per worker, returning once all are done.
+    template<class F>
+    void parallel_for(size_t begin, size_t end, F&& f, size_t chunks_per_thread = 4) {
+        if (end <= begin) {
+            return;
+        }
+
+        size_t count = end - begin;
+        size_t chunk = std::max<size_t>(1, count / (size() * chunks_per_thread));
+
+        std::vector<std::future<void>> done;
+        for (size_t from = begin; from < end; from += chunk) {
+            size_t to = std::min(from + chunk, end);
+            done.push_back(submit([&f, from, to]() { f(from, to); }));
+        }
+        for (auto& d : done) {
+            d.get();
+        }
+    }
+};
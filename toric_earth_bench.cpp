@@ -0,0 +1,288 @@
+#include <iostream>
+#include <vector>
+#include <array>
+#include <map>
+#include <chrono>
+#include <random>
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <fmt/format.h>
+
+#include "offscreen.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtx/transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "opengl_shader.h"
+#include "frame_uniforms.h"
+#include "environment.h"
+#include "textures.h"
+#include "object_loader.h"
+#include "torus.h"
+#include "map.h"
+#include "shadow_map.h"
+#include "shadow_cascades.h"
+#include "shadow_cache.h"
+#include "vehicle_placement.h"
+#include "render_graph.h"
+#include "parallel.h"
+
+
+// Renders the scene of toric_earth_run without a window, into an offscreen framebuffer,
+// while the vehicle drives a fixed path with the camera following it, and prints the
+// frame times, the time of every phase and the triangles drawn per second as JSON.
+// The path only depends on the frame number, so runs on the same machine compare.
+// Usage: toric_earth_bench [frames] [vehicles count] [width] [height] [vertex cache order, 0 or 1]
+int main(int argc, char** argv) {
+   int frames = argc > 1 ? std::stoi(argv[1]) : 1000;
+   int vehicles_count = argc > 2 ? std::stoi(argv[2]) : 100;
+   int width = argc > 3 ? std::stoi(argv[3]) : 1280;
+   int height = argc > 4 ? std::stoi(argv[4]) : 720;
+   bool vertex_cache_order = argc > 5 && std::stoi(argv[5]) != 0;
+   if (frames < 1 || vehicles_count < 1 || width < 1 || height < 1) {
+      std::cerr << "Usage: toric_earth_bench [frames] [vehicles count] [width] [height] [vertex cache order, 0 or 1]\n";
+      return 1;
+   }
+
+   // Frames run before the measured ones, until the GPU timers return results.
+   const int warmup_frames = 2 * GpuTimers::frames_in_flight;
+   const float dt = 1.f / 60;
+
+   // The defaults of toric_earth_run.
+   const float detail_coef = 2.1;
+   const float detail_dist = 3.0;
+   const int detail_repeat_count = 80;
+   const int tex1_repeat_count = 3;
+   const int tex2_repeat_count = 6;
+   const int tex3_repeat_count = 6;
+   const float lod_distance = 4.0;
+   const float shadow_distance = 30;
+
+   OffscreenContext context;
+
+   // A GLEW built for GLX finds no GLX display, but has loaded the GL functions by then.
+   GLenum glew_status = glewInit();
+   if (glew_status != GLEW_OK && glew_status != GLEW_ERROR_NO_GLX_DISPLAY) {
+      std::cerr << "Failed to initialize OpenGL loader!\n";
+      return 1;
+   }
+
+   shader_t env_shader("environment.vs", "environment.fs");
+   shader_t torus_shader("torus.vs", "torus.fs");
+   shader_t obj_shader("obj.vs", "obj.fs");
+   shader_t shadow_shader("shadow.vs", "shadow.fs");
+
+   FrameUniforms frame_uniforms;
+   frame_uniforms.attach(env_shader);
+   frame_uniforms.attach(torus_shader);
+   frame_uniforms.attach(obj_shader);
+
+   std::array<std::string, 6> env_textures;
+   env_textures.fill("../environment/space1.jpg");
+   GLuint cubemap_texture = CubemapTextureLoader::load(env_textures);
+   GLuint obj_texture = TextureLoader::load("../objects/Lexus.jpg");
+   Object obj = ObjLoader::load("../objects/", "../objects/lexus_hs.obj");
+   obj.set_vertex_cache_order(vertex_cache_order);
+   Environment env;
+
+   std::array<Texture, 3> torus_textures = {
+      Texture("../textures/tex8.jpg"),
+      Texture("../textures/tex10.jpg"),
+      Texture("../textures/tex11.jpg"),
+   };
+   std::array<Texture, 3> detail_textures = {
+      Texture("../textures/detail1.jpg"),
+      Texture("../textures/detail1.jpg"),
+      Texture("../textures/detail1.jpg"),
+   };
+   Torus torus(10, 2, "../maps/height_map.png", torus_textures, detail_textures, vertex_cache_order);
+
+   OffscreenTarget target(width, height);
+   RenderGraph render_graph;
+   ShadowCascades shadow_cascades;
+   ShadowCache shadow_cache;
+   Map map(torus);
+   Map::State state = map.get_state();
+
+   // The other vehicles stand still, so they are placed once.
+   std::mt19937 vehicles_random(1);
+   std::uniform_real_distribution<float> uniform(0, 1);
+   std::vector<glm::vec3> parked_vehicles;
+   for (int k = 1; k < vehicles_count; k++) {
+      parked_vehicles.emplace_back(uniform(vehicles_random), uniform(vehicles_random), 2 * 3.14f * uniform(vehicles_random));
+   }
+   std::vector<glm::mat4> vehicle_models(vehicles_count);
+   glm::vec2 grid_size = map.get_grid_size();
+   parallel_for(1, vehicle_models.size(), [&](size_t from, size_t to) {
+      std::vector<glm::vec2> points;
+      for (size_t k = from; k < to; k++) {
+         const glm::vec3& parked = parked_vehicles[k - 1];
+         points.push_back(glm::vec2(parked.x, parked.y) * (grid_size - 1.f));
+      }
+      std::vector<SurfaceSample> samples(points.size());
+      torus.sample(points.data(), points.size(), samples.data());
+      for (size_t k = from; k < to; k++) {
+         vehicle_models[k] = place_vehicle(obj, torus.get_model_matrix(), samples[k - from], parked_vehicles[k - 1].z);
+      }
+   });
+   obj.set_instances(vehicle_models);
+
+   glDepthFunc(GL_LEQUAL);
+   glEnable(GL_DEPTH_TEST);
+   glClearColor(0.30f, 0.55f, 0.60f, 1.00f);
+
+   typedef std::chrono::steady_clock Clock;
+   std::vector<double> frame_ms;
+   std::vector<std::string> phases = { "update" };
+   std::map<std::string, double> phase_cpu_ms;
+   double finish_ms = 0;
+   size_t triangles = 0;
+   size_t frame_triangles = 0;
+
+   for (int frame = 0; frame < warmup_frames + frames; frame++) {
+      if (frame == warmup_frames) {
+         render_graph.get_timers().reset_means();
+         phase_cpu_ms.clear();
+         finish_ms = 0;
+         triangles = 0;
+      }
+      auto frame_start = Clock::now();
+
+      // Full speed ahead, weaving left and right.
+      Map::Input input;
+      input.speed = -1;
+      input.turn = std::sin(frame * 0.02f);
+      input.grid_size = map.get_grid_size();
+      state = Map::step(state, input, dt);
+      map.set_state(state);
+
+      glm::mat4 projection = glm::perspective<float>(90, float(width) / height, 0.1, 100);
+      auto model_torus = torus.get_model_matrix();
+      auto dir = map.get_direction_on_torus();
+      SurfaceSample surface_sample = map.get_surface_sample();
+      glm::mat4 placement = model_torus * surface_sample.placement;
+      torus.select_lod(surface_sample.position, lod_distance);
+
+      obj.set_instance(0, place_vehicle(obj, model_torus, surface_sample, map.get_angle()));
+      obj.begin_instances();
+
+      // The camera follows the vehicle, rising and falling behind it.
+      auto model_camera = placement * map.get_rotation_matrix() * obj.get_model_matrix();
+      float camera_height = 0.7f + 0.3f * std::sin(frame * 0.005f);
+      glm::vec3 camera_pos = glm::vec3(placement * glm::vec4(camera_height, dir.x / 2.f, dir.y / 2.f, 1));
+      auto view = glm::lookAt(camera_pos, glm::vec3(placement[3]), glm::vec3(model_camera * glm::vec4(-1, 0, 0, 0)));
+
+      shadow_cascades.set_static_bounds(glm::vec3(model_torus[3]), torus.get_bounding_radius());
+      shadow_cascades.update(view, projection, glm::vec3(0, 0, 1), shadow_distance, 20.f, Shadow_map::size);
+      frame_uniforms.update(view, projection, shadow_cascades.get_matrices(), shadow_cascades.get_splits());
+      phase_cpu_ms["update"] += std::chrono::duration<double, std::milli>(Clock::now() - frame_start).count();
+
+      // The passes of toric_earth_run with shadows on, the static ones cached, and without the gui.
+      frame_triangles = 0;
+      render_graph.reset();
+      auto backbuffer = render_graph.import_backbuffer("backbuffer", width, height, target.get_framebuffer());
+      auto cascades = render_graph.create_depth_target("shadow cascades", ShadowCascades::count);
+
+      for (int k = 0; k < ShadowCascades::count; k++) {
+         render_graph.add_pass(fmt::format("shadow cascade {}", k), {}, { cascades }, [&, k]() {
+            glm::mat4 vp = shadow_cascades.get_matrices()[k];
+            Shadow_map& shadow = render_graph.get_depth_target(cascades);
+            if (k == ShadowCascades::count - 1) {
+               shadow_cache.update(shadow_shader, torus, model_torus, vp);
+               shadow_cache.copy_to(shadow, k);
+               shadow.render(shadow_shader, obj, vp);
+            } else {
+               shadow.bind_layer(k);
+               shadow.render(shadow_shader, torus, vp * model_torus);
+               frame_triangles += torus.get_drawn_triangles();
+               shadow.render(shadow_shader, obj, vp);
+            }
+            frame_triangles += obj.get_visible_count() * obj.get_triangles_count();
+         });
+      }
+
+      render_graph.add_pass("environment", {}, { backbuffer }, [&]() {
+         glDepthMask(GL_FALSE);
+         env.render(env_shader, cubemap_texture);
+         glDepthMask(GL_TRUE);
+      });
+
+      render_graph.add_pass("torus", { cascades }, { backbuffer }, [&]() {
+         torus_shader.use();
+         torus_shader.set_uniform("model", glm::value_ptr(model_torus));
+         torus_shader.set_uniform("detail_coef", detail_coef);
+         torus_shader.set_uniform("detail_repeat_count", detail_repeat_count);
+         torus_shader.set_uniform("detail_dist", detail_dist);
+         torus_shader.set_uniform("tex1_repeat_count", tex1_repeat_count);
+         torus_shader.set_uniform("tex2_repeat_count", tex2_repeat_count);
+         torus_shader.set_uniform("tex3_repeat_count", tex3_repeat_count);
+         torus_shader.set_uniform("shadow_cascades", render_graph.get_depth_target(cascades).bind());
+         torus_shader.set_uniform("enable", 1);
+         torus.render(torus_shader, projection * view * model_torus);
+         frame_triangles += torus.get_drawn_triangles();
+      });
+
+      render_graph.add_pass("vehicles", { cascades }, { backbuffer }, [&]() {
+         obj_shader.use();
+         obj_shader.set_uniform("shadow_cascades", render_graph.get_depth_target(cascades).bind());
+         obj_shader.set_uniform("enable", 1);
+         obj.render(obj_shader, obj_texture, cubemap_texture, projection * view);
+         get_gl_state().bind_vertex_array(0);
+         frame_triangles += obj.get_visible_count() * obj.get_triangles_count();
+      });
+
+      render_graph.execute();
+      for (auto& pass : render_graph.get_stats()) {
+         if (std::find(phases.begin(), phases.end(), pass.name) == phases.end()) {
+            phases.push_back(pass.name);
+         }
+         phase_cpu_ms[pass.name] += pass.cpu_ms;
+      }
+
+      // Without a swap nothing waits for the GPU, so the frame ends when it is done.
+      auto finish_start = Clock::now();
+      glFinish();
+      finish_ms += std::chrono::duration<double, std::milli>(Clock::now() - finish_start).count();
+
+      if (frame >= warmup_frames) {
+         frame_ms.push_back(std::chrono::duration<double, std::milli>(Clock::now() - frame_start).count());
+         triangles += frame_triangles;
+      }
+   }
+
+   double total_ms = 0;
+   for (double ms : frame_ms) {
+      total_ms += ms;
+   }
+   std::vector<double> sorted = frame_ms;
+   std::sort(sorted.begin(), sorted.end());
+   auto percentile = [&sorted](double p) {
+      return sorted[std::min(sorted.size() - 1, size_t(p * sorted.size()))];
+   };
+
+   GpuTimers& gpu_timers = render_graph.get_timers();
+   std::string json = "{\n";
+   json += fmt::format("  \"renderer\": \"{}\",\n", (const char*) glGetString(GL_RENDERER));
+   json += fmt::format("  \"frames\": {},\n  \"vehicles\": {},\n  \"width\": {},\n  \"height\": {},\n", frames, vehicles_count, width, height);
+   json += fmt::format("  \"vertex_cache_order\": {},\n", vertex_cache_order);
+   json += fmt::format(
+      "  \"frame_ms\": {{ \"mean\": {:.4f}, \"p50\": {:.4f}, \"p90\": {:.4f}, \"p95\": {:.4f}, \"p99\": {:.4f}, \"max\": {:.4f} }},\n",
+      total_ms / frames, percentile(0.5), percentile(0.9), percentile(0.95), percentile(0.99), sorted.back()
+   );
+   json += "  \"phases_ms\": {\n";
+   for (const std::string& phase : phases) {
+      json += fmt::format("    \"{}\": {{ \"cpu\": {:.4f}", phase, phase_cpu_ms[phase] / frames);
+      if (phase != "update" && gpu_timers.is_supported()) {
+         json += fmt::format(", \"gpu\": {:.4f}", gpu_timers.get_mean_ms(phase));
+      }
+      json += " },\n";
+   }
+   json += fmt::format("    \"finish\": {{ \"cpu\": {:.4f} }}\n  }},\n", finish_ms / frames);
+   json += fmt::format("  \"static_shadow_renders\": {},\n", shadow_cache.get_renders_count());
+   json += fmt::format("  \"triangles_per_second\": {:.0f}\n}}\n", triangles / (total_ms / 1000));
+   std::cout << json;
+
+   return 0;
+}
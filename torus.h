@@ -5,129 +5,700 @@
 #include <vector>
 #include <tuple>
 #include <cmath>
+#include <algorithm>
+#include <limits>
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <memory>
 #include "opengl_shader.h"
 #include "textures.h"
+#include "parallel.h"
+#include "thread_pool.h"
+#include "surface_evaluator.h"
+#include "frustum.h"
+#include "torus_lod.h"
+#include "vertex_packing.h"
+#include "vertex_cache.h"
+#include "height_field.h"
+#include "profiler.h"
+
+
+// A tile covers up to torus_tile_size x torus_tile_size quads of the (i, j) grid
+// starting at (i, j). Its vertices form a separate (torus_tile_size + 1)^2 block
+// starting at base_vertex, its indices are local to that block, one index list
+// per level of detail, shared by all the tiles of the same size.
+struct TorusTile {
+    size_t i;
+    size_t j;
+    size_t rows;
+    size_t columns;
+    std::array<size_t, torus_lod_levels> first;
+    std::array<size_t, torus_lod_levels> count;
+    GLint base_vertex;
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+
+// Position relative to the bounds of its tile with height / r in w, octahedral
+// normal and (tex_x, tex_y), then the same for the morph target; 32 bytes.
+struct PackedTorusVertex {
+    uint16_t position[4];
+    int16_t normal[2];
+    uint16_t tex_coords[2];
+    uint16_t morph_position[4];
+    int16_t morph_normal[2];
+    uint16_t morph_tex_coords[2];
+};
+
+static_assert(sizeof(PackedTorusVertex) == 32, "unexpected padding in PackedTorusVertex");
+static_assert((torus_tile_size + 1) * (torus_tile_size + 1) <= 65536, "tile indices must fit in 16 bits");
+
+
+// A procedural mesh has no vertices: torus.vs rebuilds them from gl_VertexID.
+struct TorusMesh {
+    bool procedural = false;
+    std::vector<PackedTorusVertex> vertices;
+    std::vector<uint16_t> indices;
+    std::vector<TorusTile> tiles;
+    TorusLod lod;
+    float acmr_before = 0;
+    float acmr_after = 0;
+};
+
+
+// Rays are in torus model space; max_distance is along the normalized direction.
+struct TorusRay {
+    glm::vec3 origin;
+    glm::vec3 direction;
+    float max_distance;
+};
+
+
+struct TorusHit {
+    bool hit = false;
+    // False when the march ran out of steps before the end of the ray: the surface may
+    // still be crossed past distance, up to which the ray is known to be clear.
+    bool resolved = true;
+    float distance = 0;
+    glm::vec3 position = glm::vec3(0);
+    // Grid coordinates (i, j) of the hit point.
+    glm::vec2 point = glm::vec2(0);
+};
+
+
+struct TorusBuffers {
+    GLuint vbo = 0;
+    GLuint vao = 0;
+    GLuint ebo = 0;
+    GLuint bounds_texture = 0;
+    std::vector<TorusTile> tiles;
+    TorusLod lod;
+    bool procedural = false;
+    float acmr_before = 0;
+    float acmr_after = 0;
+};
 
 
 class Torus
 {
     private:
 
-    const size_t x_count = 300;
-    const size_t y_count = 300 * 5;
+    size_t x_count = 300;
+    size_t y_count = 300 * 5;
 
     const float torus_scale = 1.f;
 
     float R;
     float r;
-    unsigned char *height_map;
+    bool procedural = false;
+    // Tile index lists reordered by VertexCache::optimize, or row-major as built.
+    bool vertex_cache_order = false;
+    // Changes whenever the surface does.
+    size_t shape_version = 0;
+    SurfaceEvaluator surface;
+    // 8 bits per texel like the image; ranges come from grid_heights, so it needs no pyramid.
+    std::shared_ptr<const HeightField<uint8_t>> height_field;
+    // Vertex heights / r over the (i, j) grid with their min/max pyramid and highest
+    // value, for ray casts; built with the grid, off the render thread when the torus
+    // is rebuilt.
+    std::shared_ptr<const HeightField<uint16_t>> grid_heights;
+    float grid_max_height;
+    GLuint height_texture;
     std::array<Texture, 3> torus_textures;
     std::array<Texture, 3> detail_textures;
 
-    int map_width = 0;
-    int map_height = 0;
+    // The front pair is drawn, the back one receives a rebuilt mesh until it is swapped in.
+    std::array<TorusBuffers, 2> buffers;
+    size_t front = 0;
+
+    std::vector<GLsizei> draw_counts;
+    std::vector<void *> draw_offsets;
+    std::vector<GLint> draw_base_vertices;
+
+    size_t drawn_triangles = 0;
+
+    // A piece of a ray in cast_ray, from a to b.
+    struct RaySpan {
+        struct End {
+            float t;
+            glm::vec3 position;
+            glm::vec4 coords;
+        };
+        End a;
+        End b;
+    };
+
+    // Vertices of the drawn triangle a grid point falls in, with their weights, and
+    // the cell of the triangle.
+    struct TrianglePoint {
+        size_t cell_i;
+        size_t cell_j;
+        size_t i[3];
+        size_t j[3];
+        float weights[3];
+    };
+
+    void fill_rows(std::vector<float>& vertices, size_t row_begin, size_t row_end) {
+        std::vector<float> row(x_count * 9);
+        float* heights = row.data();
+        float* dh_di = heights + x_count;
+        float* dh_dj = dh_di + x_count;
+        float* x = dh_dj + x_count;
+        float* y = x + x_count;
+        float* z = y + x_count;
+        float* nx = z + x_count;
+        float* ny = nx + x_count;
+        float* nz = ny + x_count;
+
+        for (size_t i = row_begin; i < row_end; i++) {
+            for (size_t j = 0; j < x_count; j++) {
+                glm::vec2 gradient = get_vertex_gradient(i, j);
+                heights[j] = get_vertex_height(i, j);
+                dh_di[j] = gradient[0];
+                dh_dj[j] = gradient[1];
+            }
+
+            surface.evaluate_row(i, 0, x_count, heights, x, y, z);
+            surface.evaluate_normals_row(i, 0, x_count, heights, dh_di, dh_dj, nx, ny, nz);
+
+            for (size_t j = 0; j < x_count; j++) {
+                float* vertex = &vertices[(i * x_count + j) * 9];
 
-    size_t indices_count;
+                vertex[0] = x[j];
+                vertex[1] = y[j];
+                vertex[2] = z[j];
 
-    GLuint vbo;
-    GLuint vao;
-    GLuint ebo;
+                vertex[3] = nx[j];
+                vertex[4] = ny[j];
+                vertex[5] = nz[j];
 
-    float get_phi(float i) {
-        return i >= y_count - 1 ? 0 : 2 * M_PI / (y_count - 1) * i;
+                vertex[6] = 1.0 * j / (x_count - 1);
+                vertex[7] = 1.0 * i / (y_count - 1);
+                vertex[8] = heights[j];
+            }
+        }
     }
 
-    float get_psi(float j) {
-        return j >= x_count - 1 ?  -M_PI : 2 * M_PI / (x_count - 1) * j - M_PI;
+    // Interleaved position / normal / (tex_x, tex_y, height) layout, 9 floats per vertex.
+    std::vector<float> get_triangle_vertices() {
+        std::vector<float> result(get_vertices_count() * 9);
+
+        parallel_for(0, y_count, [&result, this](size_t from, size_t to) {
+            fill_rows(result, from, to);
+        });
+
+        return result;
     }
 
-    std::vector<float> get_normals() {
-        std::vector<float> result;
-         for (size_t i = 0; i < y_count; i++) {
-            for (size_t j = 0; j < x_count; j++) {
+    size_t get_tiles_x() {
+        return (x_count - 2) / torus_tile_size + 1;
+    }
 
-                auto n = get_normal(i, j);
+    size_t get_tiles_y() {
+        return (y_count - 2) / torus_tile_size + 1;
+    }
+
+    static size_t get_tile_vertices_count() {
+        return (torus_tile_size + 1) * (torus_tile_size + 1);
+    }
+
+    static size_t get_lod_quads(size_t quads, size_t level) {
+        size_t stride = size_t(1) << level;
+        return (quads + stride - 1) / stride;
+    }
 
-                result.push_back(n[0]);
-                result.push_back(n[1]);
-                result.push_back(n[2]);
+    // The level at which the grid vertex (i, j) disappears: it is on the 2^level grid
+    // but not on the 2^(level + 1) one. The last row and column coincide with the first
+    // ones, so they are treated as even at every level.
+    int get_morph_level(size_t i, size_t j) {
+        size_t ii = i == y_count - 1 ? 0 : i;
+        size_t jj = j == x_count - 1 ? 0 : j;
+
+        for (size_t level = 0; level + 1 < torus_lod_levels; level++) {
+            size_t stride = size_t(2) << level;
+            if (ii % stride != 0 || jj % stride != 0) {
+                return level;
             }
-         }
-        return result;
+        }
+        return -1;
     }
 
-    std::vector<float> get_tex_coors() {
-        std::vector<float> result;
-        for (size_t i = 0; i < y_count; i++) {
-            for (size_t j = 0; j < x_count; j++) {
-                float tex_x = 1.0 * j / (x_count - 1);
-                float tex_y = 1.0 * i / (y_count - 1);
-                result.push_back(tex_x);
-                result.push_back(tex_y);
-                result.push_back(get_vertex_height(i, j));
+    // The point of the coarse edge the vertex collapses onto: the middle of its two
+    // neighbours on the 2^(level + 1) grid, along the quad diagonal if it is odd in both
+    // directions (the diagonal goes from (i, j + 1) to (i + 1, j) as in the index lists).
+    void fill_morph_target(const std::vector<float>& grid, size_t i, size_t j, int level, float* target) {
+        size_t stride = size_t(1) << level;
+        bool odd_i = i != y_count - 1 && (i / stride) % 2 == 1;
+        bool odd_j = j != x_count - 1 && (j / stride) % 2 == 1;
+
+        size_t i1 = i, i2 = i, j1 = j, j2 = j;
+        if (odd_i) {
+            i1 = i - stride;
+            i2 = std::min(i + stride, y_count - 1);
+        }
+        if (odd_j) {
+            j1 = j - stride;
+            j2 = std::min(j + stride, x_count - 1);
+        }
+        if (odd_i && odd_j) {
+            std::swap(j1, j2);
+        }
+
+        const float* a = &grid[(i1 * x_count + j1) * 9];
+        const float* b = &grid[(i2 * x_count + j2) * 9];
+
+        for (size_t k = 0; k < 9; k++) {
+            target[k] = (a[k] + b[k]) / 2;
+        }
+
+        glm::vec3 normal = glm::normalize(glm::vec3(target[3], target[4], target[5]));
+        target[3] = normal[0];
+        target[4] = normal[1];
+        target[5] = normal[2];
+    }
+
+    void pack_vertex(
+        const float* source,
+        const TorusTile& tile,
+        uint16_t* position,
+        int16_t* normal,
+        uint16_t* tex_coords
+    ) {
+        pack_position(glm::vec3(source[0], source[1], source[2]), tile.min, get_extent(tile.min, tile.max), position);
+        position[3] = pack_unorm16(source[8] / r);
+        pack_normal(glm::vec3(source[3], source[4], source[5]), normal);
+        tex_coords[0] = pack_unorm16(source[6]);
+        tex_coords[1] = pack_unorm16(source[7]);
+    }
+
+    // Morph targets lie between two vertices of the same tile, so the bounds of
+    // the tile vertices cover them too.
+    void fill_tile_vertices(const std::vector<float>& grid, TorusMesh& mesh, TorusTile& tile) {
+        tile.min = glm::vec3(std::numeric_limits<float>::max());
+        tile.max = glm::vec3(std::numeric_limits<float>::lowest());
+
+        for (size_t a = 0; a <= torus_tile_size; a++) {
+            size_t i = std::min(tile.i + a, y_count - 1);
+
+            for (size_t b = 0; b <= torus_tile_size; b++) {
+                size_t j = std::min(tile.j + b, x_count - 1);
+                const float* source = &grid[(i * x_count + j) * 9];
+
+                glm::vec3 position(source[0], source[1], source[2]);
+                tile.min = glm::min(tile.min, position);
+                tile.max = glm::max(tile.max, position);
+            }
+        }
+
+        PackedTorusVertex* vertex = &mesh.vertices[tile.base_vertex];
+        float target[9];
+
+        for (size_t a = 0; a <= torus_tile_size; a++) {
+            size_t i = std::min(tile.i + a, y_count - 1);
+
+            for (size_t b = 0; b <= torus_tile_size; b++, vertex++) {
+                size_t j = std::min(tile.j + b, x_count - 1);
+                const float* source = &grid[(i * x_count + j) * 9];
+
+                int level = get_morph_level(i, j);
+                if (level >= 0) {
+                    fill_morph_target(grid, i, j, level, target);
+                } else {
+                    std::copy(source, source + 9, target);
+                }
+
+                pack_vertex(source, tile, vertex->position, vertex->normal, vertex->tex_coords);
+                pack_vertex(target, tile, vertex->morph_position, vertex->morph_normal, vertex->morph_tex_coords);
             }
         }
-        return result;
     }
 
-    std::vector<unsigned int> get_indices() {
-        std::vector<unsigned int> result;
-        for (size_t i = 0; i < y_count - 1; i++) {
-            for (size_t j = 0; j < x_count - 1; j++) {
+    // Bounds of a tile without its vertices: the surface is sampled every few vertices
+    // at the lowest and highest height of the tile (a vertex lies between the two for
+    // its angles) and padded by how far the surface bends away between the samples.
+    void fill_tile_bounds(TorusTile& tile) {
+        const size_t stride = 4;
+
+        glm::vec2 heights = get_height_range(tile.i, tile.i + tile.rows, tile.j, tile.j + tile.columns);
+        float h_min = heights[0];
+        float h_max = heights[1];
+
+        tile.min = glm::vec3(std::numeric_limits<float>::max());
+        tile.max = glm::vec3(std::numeric_limits<float>::lowest());
 
-                size_t ii = i == y_count - 1 ? 0 : i + 1;
-                size_t jj = j == x_count - 1 ? 0 : j + 1;
+        for (size_t a = 0; a < tile.rows + stride; a += stride) {
+            size_t i = tile.i + std::min(a, tile.rows);
 
-                result.push_back(i*x_count + j);
-                result.push_back(i*x_count + jj);
-                result.push_back(ii*x_count + j);
-                result.push_back(i*x_count + jj);
-                result.push_back(ii*x_count + j);
-                result.push_back(ii*x_count + jj);
+            for (size_t b = 0; b < tile.columns + stride; b += stride) {
+                size_t j = tile.j + std::min(b, tile.columns);
+
+                for (float h : { h_min, h_max }) {
+                    glm::vec3 position = surface.get_vertex(i, j, h);
+                    tile.min = glm::min(tile.min, position);
+                    tile.max = glm::max(tile.max, position);
+                }
             }
         }
 
-        return result;
+        float phi_step = stride * 2 * M_PI / (y_count - 1);
+        float psi_step = stride * 2 * M_PI / (x_count - 1);
+        float pad = (R + r + h_max) * (1 - cos(phi_step / 2)) + (r + h_max) * (1 - cos(psi_step / 2));
+
+        tile.min -= glm::vec3(pad);
+        tile.max += glm::vec3(pad);
     }
 
-    std::vector<float> get_vertices() {
-        std::vector<float> result;
-        for (size_t i = 0; i < y_count; i++) {
-            for (size_t j = 0; j < x_count; j++) {
-                glm::vec3 vertex = get_vertex(i, j);
-                result.push_back(vertex[0]);
-                result.push_back(vertex[1]);
-                result.push_back(vertex[2]);
+    // Row-major index list of a rows x columns tile at the given level.
+    std::vector<uint16_t> get_tile_indices(size_t rows, size_t columns, size_t level) {
+        std::vector<uint16_t> indices;
+        size_t row = torus_tile_size + 1;
+        size_t stride = size_t(1) << level;
+
+        for (size_t qa = 0; qa < get_lod_quads(rows, level); qa++) {
+            size_t a = qa * stride;
+            size_t aa = std::min(a + stride, rows);
+
+            for (size_t qb = 0; qb < get_lod_quads(columns, level); qb++) {
+                size_t b = qb * stride;
+                size_t bb = std::min(b + stride, columns);
+
+                indices.push_back(a*row + b);
+                indices.push_back(a*row + bb);
+                indices.push_back(aa*row + b);
+                indices.push_back(a*row + bb);
+                indices.push_back(aa*row + b);
+                indices.push_back(aa*row + bb);
             }
         }
-        return result;
+        return indices;
     }
 
-    glm::vec3 get_normal(glm::vec3&& v1, glm::vec3&& v2) {
-        return cross(v2, v1);
+    using TileIndices = std::array<std::vector<uint16_t>, torus_lod_levels>;
+
+    // Tiles of the same size share their index lists, so there are at most four
+    // different ones (inner, last column, last row, corner) to order for the vertex cache
+    // when vertex_cache_order is set.
+    void build_tile_indices(TorusMesh& mesh, std::map<std::pair<size_t, size_t>, TileIndices>& shapes) {
+        double misses_before = 0;
+        double misses_after = 0;
+        double triangles = 0;
+
+        for (auto& tile : mesh.tiles) {
+            auto shape = std::make_pair(tile.rows, tile.columns);
+            if (shapes.count(shape) == 0) {
+                TileIndices& lists = shapes[shape];
+                for (size_t level = 0; level < torus_lod_levels; level++) {
+                    lists[level] = get_tile_indices(tile.rows, tile.columns, level);
+                    if (vertex_cache_order) {
+                        VertexCache::optimize(lists[level].data(), lists[level].size(), get_tile_vertices_count());
+                    }
+                }
+            }
+        }
+
+        for (auto& [shape, lists] : shapes) {
+            size_t tiles = std::count_if(mesh.tiles.begin(), mesh.tiles.end(), [&shape](const TorusTile& tile) {
+                return tile.rows == shape.first && tile.columns == shape.second;
+            });
+
+            for (size_t level = 0; level < torus_lod_levels; level++) {
+                auto before = get_tile_indices(shape.first, shape.second, level);
+                double count = tiles * lists[level].size() / 3;
+                misses_before += count * VertexCache::get_acmr(before.data(), before.size());
+                misses_after += count * VertexCache::get_acmr(lists[level].data(), lists[level].size());
+                triangles += count;
+            }
+        }
+
+        mesh.acmr_before = misses_before / triangles;
+        mesh.acmr_after = misses_after / triangles;
     }
 
-    glm::vec3 get_normal(
-        glm::vec3& n1,
-        glm::vec3& n2,
-        glm::vec3& n3,
-        glm::vec3& n4
-    ) {
-        return normalize(n1 + n2 + n3 + n4);
+    // Rearranges the (i, j) vertex grid into per-tile vertex blocks and index lists.
+    // Indices are local to a tile block, so they always fit in 16 bits, and the
+    // index buffer only holds the lists of the few different tile sizes.
+    void tile_mesh(const std::vector<float>& grid, TorusMesh& mesh) {
+        size_t tiles_x = get_tiles_x();
+        size_t tiles_y = get_tiles_y();
+        size_t tile_vertices = get_tile_vertices_count();
+
+        mesh.tiles.resize(tiles_x * tiles_y);
+
+        for (size_t ti = 0; ti < tiles_y; ti++) {
+            for (size_t tj = 0; tj < tiles_x; tj++) {
+                TorusTile& tile = mesh.tiles[ti * tiles_x + tj];
+
+                tile.i = ti * torus_tile_size;
+                tile.j = tj * torus_tile_size;
+                tile.rows = std::min(torus_tile_size, y_count - 1 - tile.i);
+                tile.columns = std::min(torus_tile_size, x_count - 1 - tile.j);
+                tile.base_vertex = (ti * tiles_x + tj) * tile_vertices;
+            }
+        }
+
+        if (!mesh.procedural) {
+            mesh.vertices.resize(mesh.tiles.size() * tile_vertices);
+        }
+
+        std::map<std::pair<size_t, size_t>, TileIndices> shapes;
+        build_tile_indices(mesh, shapes);
+
+        std::map<std::pair<size_t, size_t>, std::array<size_t, torus_lod_levels>> firsts;
+        mesh.indices.clear();
+        for (auto& [shape, lists] : shapes) {
+            for (size_t level = 0; level < torus_lod_levels; level++) {
+                firsts[shape][level] = mesh.indices.size();
+                mesh.indices.insert(mesh.indices.end(), lists[level].begin(), lists[level].end());
+            }
+        }
+
+        parallel_for(0, mesh.tiles.size(), [&grid, &mesh, &shapes, &firsts, this](size_t from, size_t to) {
+            for (size_t k = from; k < to; k++) {
+                TorusTile& tile = mesh.tiles[k];
+                auto shape = std::make_pair(tile.rows, tile.columns);
+
+                if (mesh.procedural) {
+                    fill_tile_bounds(tile);
+                } else {
+                    fill_tile_vertices(grid, mesh, tile);
+                }
+                for (size_t level = 0; level < torus_lod_levels; level++) {
+                    tile.first[level] = firsts.at(shape)[level];
+                    tile.count[level] = shapes.at(shape)[level].size();
+                }
+            }
+        });
+
+        build_lod(mesh.tiles, mesh.lod);
+    }
+
+    void build_lod(const std::vector<TorusTile>& tiles, TorusLod& lod) {
+        std::vector<glm::vec3> tile_min, tile_max;
+        for (auto& tile : tiles) {
+            tile_min.push_back(tile.min);
+            tile_max.push_back(tile.max);
+        }
+        lod.build(get_tiles_x(), get_tiles_y(), tile_min, tile_max);
+    }
+
+    // One multi-draw per level of detail, each with the morph range of that level.
+    void render_visible(shader_t& shader, const glm::mat4& mvp) {
+        PROFILE_ZONE("Torus::render_visible");
+        TorusBuffers& b = buffers[front];
+        Frustum frustum(mvp);
+
+        drawn_triangles = 0;
+
+        shader.set_uniform("procedural", (int) b.procedural);
+        shader.set_uniform("tile_positions", 1);
+        shader.set_uniform("torus_R", R);
+        shader.set_uniform("torus_r", r);
+        shader.set_uniform("x_count", (int) x_count);
+        shader.set_uniform("y_count", (int) y_count);
+        shader.set_uniform("tiles_x", (int) get_tiles_x());
+
+        if (b.procedural) {
+            shader.set_uniform("height_map", get_gl_state().bind_texture(GL_TEXTURE_2D, height_texture));
+        } else {
+            shader.set_uniform("tile_bounds", get_gl_state().bind_texture(GL_TEXTURE_2D, b.bounds_texture));
+        }
+
+        get_gl_state().bind_vertex_array(b.vao);
+
+        for (size_t level = 0; level < torus_lod_levels; level++) {
+            draw_counts.clear();
+            draw_offsets.clear();
+            draw_base_vertices.clear();
+
+            for (size_t k = 0; k < b.tiles.size(); k++) {
+                auto& tile = b.tiles[k];
+                if (b.lod.get_tile_level(k) == (int) level && frustum.intersects(tile.min, tile.max)) {
+                    draw_counts.push_back(tile.count[level]);
+                    draw_offsets.push_back((void *)(tile.first[level] * sizeof(uint16_t)));
+                    draw_base_vertices.push_back(tile.base_vertex);
+                    drawn_triangles += tile.count[level] / 3;
+                }
+            }
+
+            if (draw_counts.empty()) {
+                continue;
+            }
+
+            shader.set_uniform("lod_level", b.lod.is_enabled() ? (int) level : -1);
+            if (b.lod.is_enabled()) {
+                auto focus = b.lod.get_focus();
+                auto morph = b.lod.get_morph_range(level);
+                shader.set_uniform("lod_focus", focus[0], focus[1], focus[2]);
+                shader.set_uniform("lod_morph", morph[0], morph[1]);
+            }
+
+            glMultiDrawElementsBaseVertex(
+                GL_TRIANGLES,
+                draw_counts.data(),
+                GL_UNSIGNED_SHORT,
+                draw_offsets.data(),
+                draw_counts.size(),
+                draw_base_vertices.data()
+            );
+        }
+
+        shader.set_uniform("lod_level", -1);
+        shader.set_uniform("procedural", 0);
+        shader.set_uniform("tile_positions", 0);
     }
 
-    void load_height_map(const std::string& height_map_file) {
-        int nrChannels = 0;
-        height_map = stbi_load(
-            height_map_file.c_str(),
-            &map_width,
-            &map_height,
-            &nrChannels, 
-            STBI_rgb
+    // The height field for the procedural torus, filtered like get_vertex_height(size_t, size_t).
+    void load_height_texture() {
+        glGenTextures(1, &height_texture);
+        get_gl_state().bind_texture(GL_TEXTURE_2D, height_texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(
+            GL_TEXTURE_2D,
+            0,
+            GL_R8,
+            height_field->get_width(),
+            height_field->get_height(),
+            0,
+            GL_RED,
+            GL_UNSIGNED_BYTE,
+            height_field->data()
         );
-        if (!height_map) {
-            throw std::runtime_error("error in loading height map");
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+
+    TorusBuffers create_buffers() {
+        TorusBuffers b;
+
+        glGenVertexArrays(1, &b.vao);
+        glGenBuffers(1, &b.vbo);
+        glGenBuffers(1, &b.ebo);
+        get_gl_state().bind_vertex_array(b.vao);
+        glBindBuffer(GL_ARRAY_BUFFER, b.vbo);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, b.ebo);
+
+        GLsizei stride = sizeof(PackedTorusVertex);
+        glVertexAttribPointer(0, 4, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void *) offsetof(PackedTorusVertex, position));
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, stride, (void *) offsetof(PackedTorusVertex, normal));
+        glVertexAttribPointer(2, 2, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void *) offsetof(PackedTorusVertex, tex_coords));
+        glVertexAttribPointer(3, 4, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void *) offsetof(PackedTorusVertex, morph_position));
+        glVertexAttribPointer(4, 2, GL_SHORT, GL_TRUE, stride, (void *) offsetof(PackedTorusVertex, morph_normal));
+        glVertexAttribPointer(5, 2, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void *) offsetof(PackedTorusVertex, morph_tex_coords));
+        for (GLuint k = 0; k < 6; k++) {
+            glEnableVertexAttribArray(k);
         }
+
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        get_gl_state().bind_vertex_array(0);
+
+        glGenTextures(1, &b.bounds_texture);
+        get_gl_state().bind_texture(GL_TEXTURE_2D, b.bounds_texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        return b;
+    }
+
+    void allocate_buffers(TorusBuffers& b, const TorusMesh& mesh) {
+        get_gl_state().bind_vertex_array(b.vao);
+        glBindBuffer(GL_ARRAY_BUFFER, b.vbo);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(PackedTorusVertex) * mesh.vertices.size(), nullptr, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, b.ebo);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint16_t) * mesh.indices.size(), nullptr, GL_STATIC_DRAW);
+
+        for (GLuint k = 0; k < 6; k++) {
+            if (mesh.procedural) {
+                glDisableVertexAttribArray(k);
+            } else {
+                glEnableVertexAttribArray(k);
+            }
+        }
+
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        get_gl_state().bind_vertex_array(0);
+
+        // Quantization box of tile (ti, tj) as texels (2 tj, ti) = min and (2 tj + 1, ti) = extent.
+        if (!mesh.procedural) {
+            std::vector<glm::vec3> bounds;
+            for (auto& tile : mesh.tiles) {
+                bounds.push_back(tile.min);
+                bounds.push_back(get_extent(tile.min, tile.max));
+            }
+            size_t tiles_x = mesh.tiles.back().j / torus_tile_size + 1;
+            size_t tiles_y = mesh.tiles.back().i / torus_tile_size + 1;
+            get_gl_state().bind_texture(GL_TEXTURE_2D, b.bounds_texture);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, 2 * tiles_x, tiles_y, 0, GL_RGB, GL_FLOAT, bounds.data());
+        }
+
+        b.tiles = mesh.tiles;
+        b.lod = mesh.lod;
+        b.procedural = mesh.procedural;
+        b.acmr_before = mesh.acmr_before;
+        b.acmr_after = mesh.acmr_after;
+    }
+
+    // Vertex bytes go first, index bytes after them, `uploaded` counts both.
+    bool upload_buffers(TorusBuffers& b, const TorusMesh& mesh, size_t& uploaded, size_t budget) {
+        size_t vertices_size = sizeof(PackedTorusVertex) * mesh.vertices.size();
+        size_t indices_size = sizeof(uint16_t) * mesh.indices.size();
+
+        get_gl_state().bind_vertex_array(b.vao);
+
+        if (uploaded < vertices_size) {
+            size_t size = std::min(budget, vertices_size - uploaded);
+            glBindBuffer(GL_ARRAY_BUFFER, b.vbo);
+            glBufferSubData(
+                GL_ARRAY_BUFFER,
+                uploaded,
+                size,
+                (const char *) mesh.vertices.data() + uploaded
+            );
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            uploaded += size;
+            budget -= size;
+        }
+
+        if (uploaded >= vertices_size && budget > 0) {
+            size_t offset = uploaded - vertices_size;
+            size_t size = std::min(budget, indices_size - offset);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, b.ebo);
+            glBufferSubData(
+                GL_ELEMENT_ARRAY_BUFFER,
+                offset,
+                size,
+                (const char *) mesh.indices.data() + offset
+            );
+            uploaded += size;
+        }
+
+        get_gl_state().bind_vertex_array(0);
+
+        return uploaded >= vertices_size + indices_size;
     }
 
     public:
@@ -137,75 +708,103 @@ class Torus
         float r, 
         const std::string& height_map_file,
         const std::array<Texture, 3>& torus_textures,
-        const std::array<Texture, 3>& detail_textures
+        const std::array<Texture, 3>& detail_textures,
+        bool vertex_cache_order = false
     ) 
       : R(R) 
       , r(r)
-      , height_map(height_map)
+      , vertex_cache_order(vertex_cache_order)
+      , surface(R, r, x_count, y_count)
+      , height_field(std::make_shared<HeightField<uint8_t>>(height_map_file, false))
       , torus_textures(torus_textures)
       , detail_textures(detail_textures)
     {
        
-        load_height_map(height_map_file);
+        load_height_texture();
+        build_grid_heights();
        
-        GLuint vbo, vao, ebo;
+        for (auto& b : buffers) {
+            b = create_buffers();
+        }
 
-        std::vector<float> vertices = get_vertices();
-        std::vector<float> normals = get_normals();
-        std::vector<float> tex_coords = get_tex_coors();
+        TorusMesh mesh = build_mesh();
+        allocate_buffers(buffers[front], mesh);
 
-        std::vector<float> triangle_vertices(get_vertices_count() * 9);
-        std::vector<unsigned int> triangle_indices = get_indices();
+        size_t uploaded = 0;
+        upload_buffers(buffers[front], mesh, uploaded, mesh_size(mesh));
+    }
 
-        indices_count = triangle_indices.size();
-    
-        for (size_t i = 0, k = 0; k < get_vertices_count() * 9; i += 3, k += 9) {
-
-            triangle_vertices[k] = vertices[i];
-            triangle_vertices[k + 1] = vertices[i + 1];
-            triangle_vertices[k + 2] = vertices[i + 2];
- 
-            triangle_vertices[k + 3] = normals[i];
-            triangle_vertices[k + 4] = normals[i + 1];
-            triangle_vertices[k + 5] = normals[i + 2];
-
-            triangle_vertices[k + 6] = tex_coords[i];
-            triangle_vertices[k + 7] = tex_coords[i + 1];
-            triangle_vertices[k + 8] = tex_coords[i + 2];
-        }
-
-
-        glGenVertexArrays(1, &vao);
-        glGenBuffers(1, &vbo);
-        glGenBuffers(1, &ebo);
-        glBindVertexArray(vao);
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glBufferData(
-            GL_ARRAY_BUFFER,
-            sizeof(float) * triangle_vertices.size(),
-            triangle_vertices.data(),
-            GL_STATIC_DRAW
-        );
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-        glBufferData(
-            GL_ELEMENT_ARRAY_BUFFER,
-            sizeof(unsigned int) * triangle_indices.size(),
-            triangle_indices.data(),
-            GL_STATIC_DRAW
-        );
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 9 * sizeof(float), (void *)0);
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 9 * sizeof(float), (void *)(3 * sizeof(float)));
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 9 * sizeof(float), (void *)(6 * sizeof(float)));
-        glEnableVertexAttribArray(2);
 
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-        glBindVertexArray(0);
+    TorusMesh build_mesh() {
+        TorusMesh mesh;
+        mesh.procedural = procedural;
+        tile_mesh(procedural ? std::vector<float>() : get_triangle_vertices(), mesh);
+        return mesh;
+    }
+
+
+    // Changes the shape parameters of this (CPU side) torus only, GL buffers are not touched.
+    void reshape(float R, float r, size_t x_count, size_t y_count, bool procedural) {
+        bool grid_changed = x_count != this->x_count || y_count != this->y_count;
+        this->R = R;
+        this->r = r;
+        this->x_count = x_count;
+        this->y_count = y_count;
+        this->procedural = procedural;
+        surface = SurfaceEvaluator(R, r, x_count, y_count);
+        if (grid_changed) {
+            build_grid_heights();
+        }
+        shape_version++;
+    }
+
+
+    // A procedural torus keeps its index lists when only the radii change,
+    // so just the tile bounds are recomputed.
+    void reshape_radii(float R, float r) {
+        reshape(R, r, x_count, y_count, procedural);
+
+        TorusBuffers& b = buffers[front];
+        parallel_for(0, b.tiles.size(), [&b, this](size_t from, size_t to) {
+            for (size_t k = from; k < to; k++) {
+                fill_tile_bounds(b.tiles[k]);
+            }
+        });
+        build_lod(b.tiles, b.lod);
+    }
+
+
+    void allocate_back_buffers(const TorusMesh& mesh) {
+        allocate_buffers(buffers[1 - front], mesh);
+    }
+
 
-        this->vbo = vbo;
-        this->vao = vao;
-        this->ebo = ebo;
+    // Uploads at most budget bytes of the mesh into the back buffers,
+    // returns true once the whole mesh is there.
+    bool upload_back_buffers(const TorusMesh& mesh, size_t& uploaded, size_t budget) {
+        return upload_buffers(buffers[1 - front], mesh, uploaded, budget);
+    }
+
+
+    // Takes the shape parameters of the torus the back buffers were built from and
+    // starts drawing them; the previous front buffers are kept for the next rebuild.
+    void swap_buffers(const Torus& shape) {
+        R = shape.R;
+        r = shape.r;
+        x_count = shape.x_count;
+        y_count = shape.y_count;
+        procedural = shape.procedural;
+        vertex_cache_order = shape.vertex_cache_order;
+        surface = shape.surface;
+        grid_heights = shape.grid_heights;
+        grid_max_height = shape.grid_max_height;
+        shape_version++;
+        front = 1 - front;
+    }
+
+
+    static size_t mesh_size(const TorusMesh& mesh) {
+        return sizeof(PackedTorusVertex) * mesh.vertices.size() + sizeof(uint16_t) * mesh.indices.size();
     }
 
 
@@ -213,139 +812,516 @@ class Torus
         return x_count * y_count;
     }
 
+    // The height map covers half of the grid in each direction and is mirrored onto
+    // the other half; these are its texel coordinates at the grid point (i, j).
+    glm::vec2 get_map_coords(float i, float j) {
+        float ii = i >= y_count / 2 ? y_count - i - 1 : i;
+        float jj = j >= x_count / 2 ? x_count - j - 1 : j;
+        return glm::vec2(jj / x_count * height_field->get_width(), ii / y_count * height_field->get_height());
+    }
+
+    // Lowest and highest vertex height of the grid rows [i0, i1] and columns [j0, j1],
+    // which bound the drawn triangles between them too.
+    glm::vec2 get_height_range(size_t i0, size_t i1, size_t j0, size_t j1) {
+        return grid_heights->get_texel_range(j0, i0, j1, i1) * r;
+    }
+
+    // Splits the rows or columns [a0, a1] of a grid wrapping after count - 1 into
+    // at most two non-wrapping spans; a0 is less than one period away from [0, count - 1).
+    template<class F>
+    static void for_each_span(int a0, int a1, size_t count, F&& f) {
+        int period = count - 1;
+        if (a1 - a0 >= period) {
+            f(0, period);
+            return;
+        }
+        int b0 = a0 < 0 ? a0 + period : a0 >= period ? a0 - period : a0;
+        int b1 = b0 + (a1 - a0);
+        if (b1 <= period) {
+            f(b0, b1);
+        } else {
+            f(b0, period);
+            f(0, b1 - period);
+        }
+    }
+
+    void build_grid_heights() {
+        std::vector<uint16_t> values(x_count * y_count);
+        parallel_for(0, y_count, [&values, this](size_t from, size_t to) {
+            for (size_t i = from; i < to; i++) {
+                for (size_t j = 0; j < x_count; j++) {
+                    glm::vec2 coords = get_map_coords(i, j);
+                    values[i * x_count + j] = pack_unorm16(height_field->sample_bilinear(coords.x, coords.y));
+                }
+            }
+        });
+        grid_heights = std::make_shared<HeightField<uint16_t>>(x_count, y_count, std::move(values));
+        grid_max_height = grid_heights->get_texel_max(0, 0, x_count - 1, y_count - 1);
+    }
+
+    // Highest vertex height of the rows [i0, i1] and columns [j0, j1], wrapping around the grid.
+    float get_grid_max_height(int i0, int i1, int j0, int j1) {
+        float result = 0;
+        for_each_span(i0, i1, y_count, [&](int a0, int a1) {
+            for_each_span(j0, j1, x_count, [&](int b0, int b1) {
+                result = std::max(result, grid_heights->get_texel_max(b0, a0, b1, a1));
+            });
+        });
+        return result * r;
+    }
+
+    glm::vec3 get_grid_vertex(size_t i, size_t j) {
+        return surface.get_vertex(i, j, grid_heights->get(j, i) * r);
+    }
+
+    // Distance along the unit direction d from o to the triangle (a, b, c), negative
+    // if the line misses it; edges are widened a little so rays cannot slip between
+    // neighbouring triangles.
+    static float intersect_triangle(const glm::vec3& o, const glm::vec3& d, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+        const float tolerance = 1e-5f;
+        glm::vec3 e1 = b - a;
+        glm::vec3 e2 = c - a;
+        glm::vec3 p = glm::cross(d, e2);
+        float det = glm::dot(e1, p);
+        if (det == 0) {
+            return -1;
+        }
+        glm::vec3 s = o - a;
+        float u = glm::dot(s, p) / det;
+        glm::vec3 q = glm::cross(s, e1);
+        float v = glm::dot(d, q) / det;
+        if (u < -tolerance || v < -tolerance || u + v > 1 + tolerance) {
+            return -1;
+        }
+        return glm::dot(e2, q) / det;
+    }
+
+    // Shortest distance between the segments [p0, p1] and [q0, q1].
+    static float get_segments_distance(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& q0, const glm::vec3& q1) {
+        glm::vec3 u = p1 - p0;
+        glm::vec3 v = q1 - q0;
+        glm::vec3 w = p0 - q0;
+        float a = glm::dot(u, u);
+        float b = glm::dot(u, v);
+        float c = glm::dot(v, v);
+        float d = glm::dot(u, w);
+        float e = glm::dot(v, w);
+
+        float s = 0;
+        float t = 0;
+        if (a > 0 && c > 0) {
+            float denominator = a * c - b * b;
+            s = denominator > 0 ? std::clamp((b * e - c * d) / denominator, 0.f, 1.f) : 0.f;
+            t = (b * s + e) / c;
+            if (t < 0 || t > 1) {
+                t = std::clamp(t, 0.f, 1.f);
+                s = std::clamp((b * t - d) / a, 0.f, 1.f);
+            }
+        } else if (a > 0) {
+            s = std::clamp(-d / a, 0.f, 1.f);
+        } else if (c > 0) {
+            t = std::clamp(e / c, 0.f, 1.f);
+        }
+        return glm::length(w + s * u - t * v);
+    }
+
+    // atan2 within about 1e-5 radians.
+    static float fast_atan2(float y, float x) {
+        float ax = std::abs(x);
+        float ay = std::abs(y);
+        float a = std::min(ax, ay) / std::max(std::max(ax, ay), 1e-30f);
+        float a2 = a * a;
+        float result = a * (0.99997726f + a2 * (-0.33262347f + a2 * (0.19354346f +
+                       a2 * (-0.11643287f + a2 * (0.05265332f + a2 * -0.01172120f)))));
+        if (ay > ax) {
+            result = 1.57079637f - result;
+        }
+        if (x < 0) {
+            result = 3.14159274f - result;
+        }
+        return y < 0 ? -result : result;
+    }
+
+    // Distance of p to the z axis and to the core circle of radius R, and its grid coordinates.
+    glm::vec4 get_toroidal_coords(const glm::vec3& p) {
+        float rho_xy = std::sqrt(p.x * p.x + p.y * p.y);
+        float q = rho_xy - R;
+        float rho = std::sqrt(q * q + p.z * p.z);
+
+        float phi = fast_atan2(p.y, p.x);
+        float psi = fast_atan2(p.z, q);
+        float i = (phi < 0 ? phi + 2 * M_PI : phi) / (2 * M_PI) * (y_count - 1);
+        float j = (psi + M_PI) / (2 * M_PI) * (x_count - 1);
+        return glm::vec4(rho_xy, rho, i >= y_count - 1 ? 0 : i, std::min(j, x_count - 1.001f));
+    }
+
+    // Mesh vertices use bilinear heights, like the height texture of the procedural torus.
     float get_vertex_height(size_t i, size_t j) {
-        return get_vertex_height(1.0f * i, 1.0f * j);
+        return grid_heights->get(j, i) * r;
+    }
+
+    // Change of the vertex height per grid step along i and j, from the neighbouring
+    // vertices like the normals of the procedural torus.
+    glm::vec2 get_vertex_gradient(size_t i, size_t j) {
+        size_t i1 = i == 0 ? y_count - 2 : i - 1;
+        size_t i2 = i == y_count - 1 ? 1 : i + 1;
+        size_t j1 = j == 0 ? x_count - 2 : j - 1;
+        size_t j2 = j == x_count - 1 ? 1 : j + 1;
+        return glm::vec2(
+            get_vertex_height(i2, j) - get_vertex_height(i1, j),
+            get_vertex_height(i, j2) - get_vertex_height(i, j1)
+        ) / 2.f;
+    }
+
+    // Points between vertices (objects on the surface, the map) are on the drawn
+    // triangles: (i, j), (i, j + 1), (i + 1, j) and (i, j + 1), (i + 1, j), (i + 1, j + 1)
+    // as in the index lists. Coordinates wrap like in SurfaceEvaluator.
+    TrianglePoint get_triangle_point(float i, float j) {
+        float rows = y_count - 1;
+        float columns = x_count - 1;
+        i = i < 0 ? i + rows : i;
+        j = j < 0 ? j + columns : j;
+        i = i >= rows || i < 0 ? 0 : i;
+        j = j >= columns || j < 0 ? 0 : j;
+        size_t ci = (size_t) i;
+        size_t cj = (size_t) j;
+        float u = i - ci;
+        float v = j - cj;
+        if (u + v <= 1) {
+            return { ci, cj, { ci, ci, ci + 1 }, { cj, cj + 1, cj }, { 1 - u - v, v, u } };
+        }
+        return { ci, cj, { ci + 1, ci, ci + 1 }, { cj + 1, cj + 1, cj }, { u + v - 1, 1 - u, 1 - v } };
     }
 
     float get_vertex_height(float i, float j) {
-        float ii = i >= y_count / 2 ? y_count - i - 1 : i;
-        float jj = j >= x_count / 2 ? x_count - j - 1 : j;
-        int y = floor((ii / y_count) * map_height);
-        int x = floor((jj / x_count) * map_width);
-        return 1.0 * height_map[3*(y * map_width + x)] / 255.0 * r; // % от r
+        TrianglePoint t = get_triangle_point(i, j);
+        float result = 0;
+        for (int k = 0; k < 3; k++) {
+            result += get_vertex_height(t.i[k], t.j[k]) * t.weights[k];
+        }
+        return result;
     }
 
     glm::vec3 get_vertex(size_t i, size_t j) {
-        float phi = i == y_count - 1 ? 0 : 2 * M_PI / (y_count - 1) * i;
-        float psi = j == x_count - 1 ?  -M_PI : 2 * M_PI / (x_count - 1) * j - M_PI;
-        float h = get_vertex_height(i, j);
-    
-        float x = (R + (r + h) * cos(psi)) * cos(phi);
-        float y = (R + (r + h) * cos(psi)) * sin(phi);
-        float z = (r + h) * sin(psi);
-
-        return {x, y, z};
+        return surface.get_vertex(i, j, get_vertex_height(i, j));
     }
 
 
     glm::vec3 get_vertex_without_height(float i, float j, float h = 0) {
-        float phi = get_phi(i);
-        float psi = get_psi(j);
-    
-        float x = (R + (r + h) * cos(psi)) * cos(phi);
-        float y = (R + (r + h) * cos(psi)) * sin(phi);
-        float z = (r + h) * sin(psi);
-
-        return {x, y, z};
+        return surface.get_vertex(i, j, h);
     }
     
 
     glm::vec3 get_vertex(float i, float j) {
-        float phi = get_phi(i);
-        float psi = get_psi(j);
-        float h = get_vertex_height(i, j);
-    
-        float x = (R + (r + h) * cos(psi)) * cos(phi);
-        float y = (R + (r + h) * cos(psi)) * sin(phi);
-        float z = (r + h) * sin(psi);
+        return surface.get_vertex(i, j, get_vertex_height(i, j));
+    }
+
+
+    void get_vertices(const glm::vec2* points, const float* heights, size_t count, glm::vec3* result) {
+        std::vector<float> buffer(count * 5);
+        float* i = buffer.data();
+        float* j = i + count;
+        float* x = j + count;
+        float* y = x + count;
+        float* z = y + count;
+
+        for (size_t k = 0; k < count; k++) {
+            i[k] = points[k][0];
+            j[k] = points[k][1];
+        }
 
-        return {x, y, z};
+        surface.evaluate(i, j, heights, count, x, y, z);
+
+        for (size_t k = 0; k < count; k++) {
+            result[k] = { x[k], y[k], z[k] };
+        }
     }
 
 
-    glm::vec3 get_normal(size_t i, size_t j, bool with_heghts = true) {
-        auto v = get_vertex(i, j);
-
-        int i1 = i == 0 ? y_count - 2 : i - 1;
-        int i2 = i == y_count - 1 ? 1 : i + 1;
-        int j1 = j == 0 ? x_count - 2 : j - 1;
-        int j2 = j == x_count - 1 ? 1 : j + 1;
-
-        glm::vec3 a, b, c, d;
-        if (with_heghts) {
-            a = get_vertex(i2, j);
-            b = get_vertex(i, j1);
-            c = get_vertex(i1, j);
-            d = get_vertex(i, j2);
-        } else {
-            a = get_vertex_without_height(i2, j);
-            b = get_vertex_without_height(i, j1);
-            c = get_vertex_without_height(i1, j);
-            d = get_vertex_without_height(i, j2);
+    void get_vertices(const glm::vec2* points, size_t count, glm::vec3* result) {
+        std::vector<float> heights(count);
+        for (size_t k = 0; k < count; k++) {
+            heights[k] = get_vertex_height(points[k][0], points[k][1]);
         }
+        get_vertices(points, heights.data(), count, result);
+    }
 
-        auto n1 = get_normal(
-            { a[0] - v[0], a[1] - v[1], a[2] - v[2] },
-            { b[0] - v[0], b[1] - v[1], b[2] - v[2] }
-        );
-        auto n2= get_normal(
-            { b[0] - v[0], b[1] - v[1], b[2] - v[2] },
-            { c[0] - v[0], c[1] - v[1], c[2] - v[2] }
-        );
-        auto n3 = get_normal(
-            { c[0] - v[0], c[1] - v[1], c[2] - v[2] },
-            { d[0] - v[0], d[1] - v[1], d[2] - v[2] }
-        );
-        auto n4 = get_normal(
-            { d[0] - v[0], d[1] - v[1], d[2] - v[2] },
-            { a[0] - v[0], a[1] - v[1], a[2] - v[2] }
-        );
 
-        return get_normal(n1, n2, n3, n4);
+    // Height on the drawn triangles and its change per grid step along i and j, the
+    // gradient blended from the vertices like the drawn normals. The vertex gradients
+    // are those of get_vertex_gradient, from one read of the 4 x 4 vertices around the cell.
+    glm::vec3 get_height_with_gradient(float i, float j) {
+        TrianglePoint t = get_triangle_point(i, j);
+        size_t ci = t.cell_i;
+        size_t cj = t.cell_j;
+        size_t rows[4] = { ci == 0 ? y_count - 2 : ci - 1, ci, ci + 1, ci + 1 == y_count - 1 ? 1 : ci + 2 };
+        size_t columns[4] = { cj == 0 ? x_count - 2 : cj - 1, cj, cj + 1, cj + 1 == x_count - 1 ? 1 : cj + 2 };
+
+        float h[4][4];
+        for (int a = 0; a < 4; a++) {
+            for (int b = 0; b < 4; b++) {
+                h[a][b] = grid_heights->get(columns[b], rows[a]);
+            }
+        }
+
+        glm::vec3 result(0);
+        for (int k = 0; k < 3; k++) {
+            size_t a = t.i[k] - ci + 1;
+            size_t b = t.j[k] - cj + 1;
+            glm::vec3 vertex(h[a][b], (h[a + 1][b] - h[a - 1][b]) / 2, (h[a][b + 1] - h[a][b - 1]) / 2);
+            result += vertex * t.weights[k];
+        }
+        return result * r;
     }
 
 
-    glm::vec3 get_normal(float i, float j, bool with_heghts = true) {
-        float delta = 1;
+    glm::vec2 get_height_gradient(float i, float j) {
+        glm::vec3 sample = get_height_with_gradient(i, j);
+        return glm::vec2(sample[1], sample[2]);
+    }
 
-        auto v = get_vertex(i, j);
 
-        int i1 = i <= 0 ? y_count - 2 : i - delta;
-        int i2 = i >= y_count - 1 ? 1 : i + delta;
-        int j1 = j <= 0 ? x_count - 2 : j - delta;
-        int j2 = j >= x_count - 1 ? 1 : j + delta;
+    // Placement of an object standing at the grid point (i, j), in torus model space.
+    SurfaceSample sample(const glm::vec2& point) {
+        glm::vec3 height = get_height_with_gradient(point[0], point[1]);
+        return surface.sample(point[0], point[1], height[0], height[1], height[2]);
+    }
 
-        glm::vec3 a, b, c, d;
-        if (with_heghts) {
-            a = get_vertex(i2, j);
-            b = get_vertex(i, j1);
-            c = get_vertex(i1, j);
-            d = get_vertex(i, j2);
-        } else {
-            a = get_vertex_without_height(i2, j);
-            b = get_vertex_without_height(i, j1);
-            c = get_vertex_without_height(i1, j);
-            d = get_vertex_without_height(i, j2);
+
+    // get_height_with_gradient for count points, structure-of-arrays out.
+    void get_heights_with_gradients(const float* i, const float* j, size_t count, float* heights, float* dh_di, float* dh_dj) {
+        for (size_t k = 0; k < count; k++) {
+            glm::vec3 height = get_height_with_gradient(i[k], j[k]);
+            heights[k] = height[0];
+            dh_di[k] = height[1];
+            dh_dj[k] = height[2];
         }
+    }
+
+
+    // sample() for count points: all heights first, then one pass of the surface evaluator.
+    void sample(const glm::vec2* points, size_t count, SurfaceSample* result) {
+        std::vector<float> buffer(count * 5);
+        float* i = buffer.data();
+        float* j = i + count;
+        float* heights = j + count;
+        float* dh_di = heights + count;
+        float* dh_dj = dh_di + count;
+
+        for (size_t k = 0; k < count; k++) {
+            i[k] = points[k][0];
+            j[k] = points[k][1];
+        }
+
+        get_heights_with_gradients(i, j, count, heights, dh_di, dh_dj);
+        surface.sample(i, j, heights, dh_di, dh_dj, count, result);
+    }
+
+
+    // First intersection of a ray with the drawn triangles (at full detail). The ray is
+    // split into spans, front to back, and the (i, j) cells a span passes over are bounded
+    // from the angles at its ends: the rows follow the azimuth, which only grows or only
+    // shrinks along a line, and the columns can turn at most by the span length over its
+    // distance to the core circle. A span further from the core circle than r plus the
+    // highest vertex height of its cells (from the height pyramid) misses them, one over
+    // at most 2 x 2 cells is tested against their triangles, others are halved. Rays that
+    // need more spans than there are come back neither a hit nor a miss.
+    TorusHit cast_ray(const TorusRay& ray) {
+        const int max_spans = 4096;
+        const int max_depth = 32;
+        // Cells are widened by this to cover the error of fast_atan2 and how far triangles
+        // stray out of their cells.
+        const float cell_margin = 0.01f;
+
+        TorusHit result;
+        glm::vec3 d = glm::normalize(ray.direction);
+        float phi_step = 2 * M_PI / (y_count - 1);
+        float psi_step = 2 * M_PI / (x_count - 1);
+        float rows = y_count - 1;
+        float columns = x_count - 1;
+        float reach = r + grid_max_height * r;
+        // How much further from the core circle a triangle between two rows can pass than its vertices.
+        float sag = (R + reach) * phi_step * phi_step / 8;
+
+        // Only the part of the ray inside the slab |z| <= reach and the sphere of radius
+        // R + reach around the centre can reach the surface.
+        float t_end = ray.max_distance;
+        float t = 0;
+        if (d.z != 0) {
+            float t0 = (-reach - ray.origin.z) / d.z;
+            float t1 = (reach - ray.origin.z) / d.z;
+            t = std::max(t, std::min(t0, t1));
+            t_end = std::min(t_end, std::max(t0, t1));
+        } else if (std::abs(ray.origin.z) > reach) {
+            return result;
+        }
+        float b = glm::dot(ray.origin, d);
+        float disc = b * b - glm::dot(ray.origin, ray.origin) + (R + reach) * (R + reach);
+        if (disc < 0) {
+            return result;
+        }
+        t = std::max(t, -b - std::sqrt(disc));
+        t_end = std::min(t_end, -b + std::sqrt(disc));
+        if (t > t_end) {
+            return result;
+        }
+
+        auto get_span_end = [&](float t) {
+            glm::vec3 p = ray.origin + t * d;
+            return RaySpan::End { t, p, get_toroidal_coords(p) };
+        };
+        auto wrap = [](float a, float period) {
+            return a - period * std::round(a / period);
+        };
+
+        std::array<RaySpan, max_depth> stack;
+        size_t depth = 0;
+        stack[depth++] = { get_span_end(t), get_span_end(t_end) };
+
+        for (int spans = 0; depth > 0; spans++) {
+            if (spans == max_spans) {
+                result.resolved = false;
+                result.distance = stack[depth - 1].a.t;
+                return result;
+            }
+            RaySpan span = stack[--depth];
+            const glm::vec4& ca = span.a.coords;
+            const glm::vec4& cb = span.b.coords;
+            float length = span.b.t - span.a.t;
+
+            // The azimuth turns by less than half a turn along a line.
+            float di = wrap(cb[2] - ca[2], rows);
+            float dj = wrap(cb[3] - ca[3], columns);
+            bool short_turn = std::abs(di) < rows / 8;
+
+            // Lower bound of the distance to the core circle: the circle arc between the
+            // azimuths of the ends is within its sag of the chord.
+            float clearance = -1;
+            if (short_turn && ca[0] > 0 && cb[0] > 0) {
+                glm::vec3 ka = glm::vec3(span.a.position.x, span.a.position.y, 0) * (R / ca[0]);
+                glm::vec3 kb = glm::vec3(span.b.position.x, span.b.position.y, 0) * (R / cb[0]);
+                float half_turn = std::abs(di) * phi_step / 2;
+                clearance = get_segments_distance(span.a.position, span.b.position, ka, kb) - R * half_turn * half_turn / 2;
+            }
+
+            int i0 = (int) std::floor(ca[2] + std::min(di, 0.f) - cell_margin);
+            int i1 = (int) std::floor(ca[2] + std::max(di, 0.f) + cell_margin);
+            int j0 = 0;
+            int j1 = columns - 1;
+            if (clearance > 0 && length / clearance < M_PI / 2) {
+                float turn = length / clearance / psi_step;
+                float lo = std::min(ca[3], ca[3] + dj);
+                float hi = std::max(ca[3], ca[3] + dj);
+                j0 = (int) std::floor(std::min(hi - turn, lo) - cell_margin);
+                j1 = (int) std::floor(std::max(lo + turn, hi) + cell_margin);
+            }
+
+            if (short_turn && clearance > 0 && clearance > r + sag + get_grid_max_height(i0, i1 + 1, j0, j1 + 1)) {
+                continue;
+            }
+
+            bool leaf = short_turn && (i1 - i0 + 1) * (j1 - j0 + 1) <= 4;
+            if (!leaf && depth + 2 <= stack.size()) {
+                RaySpan::End middle = get_span_end((span.a.t + span.b.t) / 2);
+                stack[depth++] = { middle, span.b };
+                stack[depth++] = { span.a, middle };
+                continue;
+            }
+            if (!leaf) {
+                result.resolved = false;
+                result.distance = span.a.t;
+                return result;
+            }
+
+            // Triangles (i, j), (i, j + 1), (i + 1, j) and (i, j + 1), (i + 1, j), (i + 1, j + 1)
+            // as in the index lists; a hit beyond the span is found in a later one.
+            float nearest = span.b.t + length * 1e-3f;
+            for (int ci = i0; ci <= i1; ci++) {
+                for (int cj = j0; cj <= j1; cj++) {
+                    size_t i = (ci % (int) rows + (int) rows) % (int) rows;
+                    size_t j = (cj % (int) columns + (int) columns) % (int) columns;
+                    glm::vec3 v00 = get_grid_vertex(i, j);
+                    glm::vec3 v01 = get_grid_vertex(i, j + 1);
+                    glm::vec3 v10 = get_grid_vertex(i + 1, j);
+                    glm::vec3 v11 = get_grid_vertex(i + 1, j + 1);
+                    for (float hit : { intersect_triangle(ray.origin, d, v00, v01, v10), intersect_triangle(ray.origin, d, v01, v10, v11) }) {
+                        if (hit >= span.a.t - length * 1e-3f && hit < nearest) {
+                            nearest = hit;
+                            result.hit = true;
+                        }
+                    }
+                }
+            }
+
+            if (result.hit) {
+                result.distance = nearest;
+                result.position = ray.origin + nearest * d;
+                glm::vec4 c = get_toroidal_coords(result.position);
+                result.point = glm::vec2(c[2], c[3]);
+                return result;
+            }
+        }
+        return result;
+    }
+
+
+    // Rays spread over the workers of the pool.
+    void cast_rays(const TorusRay* rays, size_t count, TorusHit* result, ThreadPool& pool) {
+        pool.parallel_for(0, count, [&](size_t from, size_t to) {
+            for (size_t k = from; k < to; k++) {
+                result[k] = cast_ray(rays[k]);
+            }
+        });
+    }
+
+
+    // Without heights the normal is that of the smooth torus through the point.
+    glm::vec3 get_normal(size_t i, size_t j, bool with_heghts = true) {
+        glm::vec2 gradient = with_heghts ? get_vertex_gradient(i, j) : glm::vec2(0);
+        return surface.get_normal(i, j, get_vertex_height(i, j), gradient[0], gradient[1]);
+    }
 
-        auto n1 = get_normal(
-            { a[0] - v[0], a[1] - v[1], a[2] - v[2] },
-            { b[0] - v[0], b[1] - v[1], b[2] - v[2] }
-        );
-        auto n2 = get_normal(
-            { b[0] - v[0], b[1] - v[1], b[2] - v[2] },
-            { c[0] - v[0], c[1] - v[1], c[2] - v[2] }
-        );
-        auto n3 = get_normal(
-            { c[0] - v[0], c[1] - v[1], c[2] - v[2] },
-            { d[0] - v[0], d[1] - v[1], d[2] - v[2] }
-        );
-        auto n4 = get_normal(
-            { d[0] - v[0], d[1] - v[1], d[2] - v[2] },
-            { a[0] - v[0], a[1] - v[1], a[2] - v[2] }
-        );
 
-        return get_normal(n1, n2, n3, n4);
+    glm::vec3 get_normal(float i, float j, bool with_heghts = true) {
+        glm::vec2 gradient = with_heghts ? get_height_gradient(i, j) : glm::vec2(0);
+        return surface.get_normal(i, j, get_vertex_height(i, j), gradient[0], gradient[1]);
+    }
+
+
+    float get_R() {
+        return R;
+    }
+
+
+    float get_r() {
+        return r;
+    }
+
+
+    bool is_procedural() {
+        return procedural;
+    }
+
+
+    bool get_vertex_cache_order() {
+        return vertex_cache_order;
+    }
+
+
+    // Takes effect with the next mesh built, as for reshape.
+    void set_vertex_cache_order(bool enabled) {
+        vertex_cache_order = enabled;
+    }
+
+
+    size_t get_shape_version() {
+        return shape_version;
+    }
+
+
+    // Radius of the sphere around the centre holding the whole surface, in model space.
+    float get_bounding_radius() {
+        return R + r + grid_max_height * r;
     }
 
 
@@ -363,44 +1339,52 @@ class Torus
         return glm::scale(glm::vec3(torus_scale, torus_scale, torus_scale));
     }
 
-    
-    glm::mat4 get_translation_matrix(glm::vec2 position, Object obj) {
-        return glm::rotate(get_phi(position[0]), glm::vec3(0, 0, 1)) *
-               glm::translate(glm::vec3(R * torus_scale, 0, 0)) *
-               glm::rotate(-get_psi(position[1]), glm::vec3(0, 1, 0)) *
-               glm::translate(glm::vec3(r * torus_scale + get_vertex_height(position[0], position[1]), 0, 0));
+
+    // Picks the level of detail of every tile for this frame, finest around focus.
+    void select_lod(const glm::vec3& focus, float distance) {
+        buffers[front].lod.select(focus, distance);
     }
 
-    void render() {
-        glBindVertexArray(vao);
-        glDrawElements(GL_TRIANGLES, indices_count, GL_UNSIGNED_INT, 0);
+    void reset_lod() {
+        buffers[front].lod.reset();
     }
 
-   
-    void render(shader_t& torus_shader) {
+    // The selection made by select_lod, to draw at another level of detail and put it back.
+    const TorusLod& get_lod() {
+        return buffers[front].lod;
+    }
 
-        for (int i = 0; i < 3; i++) {
-            glActiveTexture(GL_TEXTURE0 + torus_textures[i].get_id());
-            glBindTexture(GL_TEXTURE_2D, torus_textures[i].get_id());
-        }
+    void set_lod(const TorusLod& lod) {
+        buffers[front].lod = lod;
+    }
 
-         for (int i = 0; i < 3; i++) {
-            glActiveTexture(GL_TEXTURE0 + detail_textures[i].get_id());
-            glBindTexture(GL_TEXTURE_2D, detail_textures[i].get_id());
-        }
+    size_t get_drawn_triangles() {
+        return drawn_triangles;
+    }
 
-        torus_shader.use();
+    // Average cache miss ratio of the index lists row-major and as drawn, the same
+    // unless they are in vertex cache order.
+    glm::vec2 get_acmr() {
+        return glm::vec2(buffers[front].acmr_before, buffers[front].acmr_after);
+    }
 
-        torus_shader.set_uniform("tex1", (int) torus_textures[0].get_id());
-        torus_shader.set_uniform("tex2", (int) torus_textures[1].get_id());
-        torus_shader.set_uniform("tex3", (int) torus_textures[2].get_id());
+    void render_depth(shader_t& shader, const glm::mat4& mvp) {
+        render_visible(shader, mvp);
+    }
+
+   
+    void render(shader_t& torus_shader, const glm::mat4& mvp) {
+
+        torus_shader.use();
 
-        torus_shader.set_uniform("detail_tex1", (int) detail_textures[0].get_id());
-        torus_shader.set_uniform("detail_tex2", (int) detail_textures[1].get_id());
-        torus_shader.set_uniform("detail_tex3", (int) detail_textures[2].get_id());
+        torus_shader.set_uniform("tex1", torus_textures[0].bind());
+        torus_shader.set_uniform("tex2", torus_textures[1].bind());
+        torus_shader.set_uniform("tex3", torus_textures[2].bind());
 
-        glBindVertexArray(vao);
+        torus_shader.set_uniform("detail_tex1", detail_textures[0].bind());
+        torus_shader.set_uniform("detail_tex2", detail_textures[1].bind());
+        torus_shader.set_uniform("detail_tex3", detail_textures[2].bind());
 
-        glDrawElements(GL_TRIANGLES, indices_count, GL_UNSIGNED_INT, 0);
+        render_visible(torus_shader, mvp);
     }
 };
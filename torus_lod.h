@@ -0,0 +1,168 @@
+#pragma once
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <glm/glm.hpp>
+
+
+// Tiles are torus_tile_size x torus_tile_size quads; a tile drawn at level L
+// uses every 2^L-th vertex of its block, so levels go up to log2(torus_tile_size).
+constexpr size_t torus_tile_size = 32;
+constexpr size_t torus_lod_levels = 6;
+
+
+// Quadtree over the tile grid: a node of level L covers 2^L x 2^L tiles.
+// Selection follows CDLOD: level L is used for parts of the surface between
+// get_range(L - 1) and get_range(L) from the focus point, and every tile is
+// assigned the level of the node that covers it.
+class TorusLod {
+
+    private:
+
+    struct Node {
+        glm::vec3 min;
+        glm::vec3 max;
+    };
+
+    size_t tiles_x = 0;
+    size_t tiles_y = 0;
+
+    std::vector<std::vector<Node>> nodes;
+    std::vector<int> tile_levels;
+
+    glm::vec3 focus;
+    float distance = 0;
+
+    size_t get_rows(size_t level) {
+        return (tiles_y + (size_t(1) << level) - 1) >> level;
+    }
+
+    size_t get_columns(size_t level) {
+        return (tiles_x + (size_t(1) << level) - 1) >> level;
+    }
+
+    bool intersects(const Node& node, float range) {
+        glm::vec3 closest = glm::min(glm::max(focus, node.min), node.max);
+        return glm::distance(closest, focus) <= range;
+    }
+
+    void set_level(size_t node_level, size_t ni, size_t nj, int level) {
+        size_t i_end = std::min((ni + 1) << node_level, tiles_y);
+        size_t j_end = std::min((nj + 1) << node_level, tiles_x);
+
+        for (size_t i = ni << node_level; i < i_end; i++) {
+            for (size_t j = nj << node_level; j < j_end; j++) {
+                tile_levels[i * tiles_x + j] = level;
+            }
+        }
+    }
+
+    bool select(size_t level, size_t ni, size_t nj) {
+        const Node& node = nodes[level][ni * get_columns(level) + nj];
+
+        if (!intersects(node, get_range(level))) {
+            return false;
+        }
+        if (level == 0) {
+            set_level(level, ni, nj, level);
+            return true;
+        }
+        if (!intersects(node, get_range(level - 1))) {
+            set_level(level, ni, nj, level);
+            return true;
+        }
+
+        for (size_t ci = 2 * ni; ci < std::min(2 * ni + 2, get_rows(level - 1)); ci++) {
+            for (size_t cj = 2 * nj; cj < std::min(2 * nj + 2, get_columns(level - 1)); cj++) {
+                if (!select(level - 1, ci, cj)) {
+                    set_level(level - 1, ci, cj, level);
+                }
+            }
+        }
+        return true;
+    }
+
+    public:
+
+    // tile_min / tile_max are the bounding boxes of the tiles in row-major order.
+    void build(
+        size_t tiles_x,
+        size_t tiles_y,
+        const std::vector<glm::vec3>& tile_min,
+        const std::vector<glm::vec3>& tile_max
+    ) {
+        this->tiles_x = tiles_x;
+        this->tiles_y = tiles_y;
+
+        nodes.assign(torus_lod_levels, {});
+        nodes[0].resize(tiles_x * tiles_y);
+        for (size_t k = 0; k < nodes[0].size(); k++) {
+            nodes[0][k] = { tile_min[k], tile_max[k] };
+        }
+
+        for (size_t level = 1; level < torus_lod_levels; level++) {
+            size_t rows = get_rows(level);
+            size_t columns = get_columns(level);
+            nodes[level].assign(rows * columns, {
+                glm::vec3(std::numeric_limits<float>::max()),
+                glm::vec3(std::numeric_limits<float>::lowest())
+            });
+
+            for (size_t i = 0; i < get_rows(level - 1); i++) {
+                for (size_t j = 0; j < get_columns(level - 1); j++) {
+                    const Node& child = nodes[level - 1][i * get_columns(level - 1) + j];
+                    Node& node = nodes[level][(i / 2) * columns + j / 2];
+                    node.min = glm::min(node.min, child.min);
+                    node.max = glm::max(node.max, child.max);
+                }
+            }
+        }
+
+        tile_levels.assign(tiles_x * tiles_y, 0);
+    }
+
+    // distance is the radius of the finest level, every next level doubles it.
+    void select(const glm::vec3& focus, float distance) {
+        this->focus = focus;
+        this->distance = distance;
+
+        size_t top = torus_lod_levels - 1;
+        for (size_t ni = 0; ni < get_rows(top); ni++) {
+            for (size_t nj = 0; nj < get_columns(top); nj++) {
+                if (!select(top, ni, nj)) {
+                    set_level(top, ni, nj, top);
+                }
+            }
+        }
+    }
+
+    void reset() {
+        distance = 0;
+        std::fill(tile_levels.begin(), tile_levels.end(), 0);
+    }
+
+    bool is_enabled() {
+        return distance > 0;
+    }
+
+    const glm::vec3& get_focus() {
+        return focus;
+    }
+
+    float get_range(size_t level) {
+        return distance * (1 << level);
+    }
+
+    // Vertices that disappear at the next level move to the coarse edge between
+    // these two distances, so level switches do not pop.
+    glm::vec2 get_morph_range(size_t level) {
+        float end = get_range(level);
+        float start = level == 0 ? 0 : get_range(level - 1);
+        return glm::vec2(start + (end - start) * 0.7f, end);
+    }
+
+    int get_tile_level(size_t tile) {
+        return tile_levels[tile];
+    }
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <future>
+#include <memory>
+#include <optional>
+#include <chrono>
+#include "torus.h"
+
+
+// Rebuilds the torus mesh for new radii / resolution on a worker thread,
+// uploads it into the torus back buffers a slice per frame and swaps it in
+// once it is complete, so the current mesh keeps being drawn meanwhile.
+class TorusRebuild {
+
+    private:
+
+    struct Shape {
+        float R;
+        float r;
+        size_t x_count;
+        size_t y_count;
+        bool procedural;
+        bool vertex_cache_order;
+    };
+
+    struct Result {
+        Torus shape;
+        TorusMesh mesh;
+    };
+
+    Torus& torus;
+
+    std::future<std::unique_ptr<Result>> build;
+    std::unique_ptr<Result> result;
+    std::optional<Shape> pending;
+
+    size_t uploaded = 0;
+    size_t upload_budget = 4 << 20;
+
+    void start(const Shape& s) {
+        build = std::async(std::launch::async, [shape = torus, s]() mutable {
+            shape.reshape(s.R, s.r, s.x_count, s.y_count, s.procedural);
+            shape.set_vertex_cache_order(s.vertex_cache_order);
+            TorusMesh mesh = shape.build_mesh();
+            return std::unique_ptr<Result>(new Result { std::move(shape), std::move(mesh) });
+        });
+    }
+
+    public:
+
+    TorusRebuild(Torus& torus) : torus(torus) {}
+
+    // The latest request wins if several arrive while a rebuild is running.
+    // Radii changes of a procedural torus need no new mesh and apply at once.
+    void request(float R, float r, size_t x_count, size_t y_count, bool procedural, bool vertex_cache_order) {
+        bool same_mesh = procedural && torus.is_procedural() &&
+                         x_count == (size_t) torus.get_x_count() &&
+                         y_count == (size_t) torus.get_y_count() &&
+                         vertex_cache_order == torus.get_vertex_cache_order();
+
+        if (same_mesh && !is_busy()) {
+            torus.reshape_radii(R, r);
+            return;
+        }
+        pending = Shape { R, r, x_count, y_count, procedural, vertex_cache_order };
+    }
+
+    bool is_busy() {
+        return build.valid() || result || pending;
+    }
+
+    // Called once per frame from the render thread.
+    void update() {
+        if (build.valid() && build.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            result = build.get();
+            torus.allocate_back_buffers(result->mesh);
+            uploaded = 0;
+        }
+
+        if (result && torus.upload_back_buffers(result->mesh, uploaded, upload_budget)) {
+            torus.swap_buffers(result->shape);
+            result.reset();
+        }
+
+        if (!build.valid() && !result && pending) {
+            start(*pending);
+            pending.reset();
+        }
+    }
+};
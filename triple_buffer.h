@@ -0,0 +1,46 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+
+// Single producer, single consumer hand-off of the latest value without locks.
+// The writer and the reader each own a slot; the third one is exchanged between
+// them atomically together with a flag telling whether it holds an unread value.
+template<typename T>
+class TripleBuffer {
+
+    private:
+
+    static constexpr uint8_t index_mask = 3;
+    static constexpr uint8_t fresh_bit = 4;
+
+    std::array<T, 3> slots;
+    std::atomic<uint8_t> middle { 1 };
+
+    uint8_t back = 0;
+    uint8_t front = 2;
+
+    public:
+
+    TripleBuffer(const T& initial = T()) {
+        slots.fill(initial);
+    }
+
+    // Writer thread only.
+    void write(const T& value) {
+        slots[back] = value;
+        back = middle.exchange(back | fresh_bit, std::memory_order_acq_rel) & index_mask;
+    }
+
+    // Reader thread only: the latest written value, true if it was not read before.
+    bool read(T& value) {
+        bool fresh = middle.load(std::memory_order_relaxed) & fresh_bit;
+        if (fresh) {
+            front = middle.exchange(front, std::memory_order_acq_rel) & index_mask;
+        }
+        value = slots[front];
+        return fresh;
+    }
+};
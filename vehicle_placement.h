@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cmath>
+#include <glm/glm.hpp>
+#include <glm/gtx/transform.hpp>
+#include <glm/gtx/rotate_vector.hpp>
+#include "object_loader.h"
+#include "surface_evaluator.h"
+
+
+// Model matrix of a vehicle standing on the torus at s, turned by angle.
+inline glm::mat4 place_vehicle(Object& obj, const glm::mat4& model_torus, const SurfaceSample& s, float angle) {
+    auto model_obj = obj.get_model_matrix();
+
+    glm::vec3 bottom_center = glm::vec3(model_obj * glm::vec4(obj.get_bottom_center(), 1));
+    glm::vec3 torus_point = glm::vec3(model_torus * glm::vec4(s.position, 1));
+    glm::vec3 torus_normal = glm::vec3(model_torus * glm::vec4(s.normal, 0));
+
+    auto to_normal = glm::orientation(torus_normal, glm::vec3(1, 0, 0));
+    glm::vec3 new_y = normalize(glm::vec3(to_normal * glm::vec4(0, 1, 0, 0)));
+    glm::vec3 new_x = normalize(glm::vec3(to_normal * glm::vec4(1, 0, 0, 0)));
+    glm::vec3 new_z = normalize(glm::vec3(to_normal * glm::vec4(0, 0, 1, 0)));
+    glm::vec3 torus_dir_x = normalize(glm::vec3(model_torus * glm::vec4(s.tangent_i, 0)));
+    glm::vec3 torus_dir_y = normalize(glm::vec3(model_torus * glm::vec4(s.tangent_j, 0)));
+
+    auto beta = acos(dot(new_z, torus_dir_x));
+    if (dot(new_z, torus_dir_y) > 0) {
+        beta = -beta;
+    }
+
+    auto rot1 = glm::rotate(beta, new_x);
+    auto rot2 = glm::rotate(angle + 3.14f / 2.f, new_x);
+    return glm::translate(torus_point - bottom_center) * rot2 * rot1 * to_normal * model_obj;
+}
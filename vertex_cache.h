@@ -0,0 +1,182 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+
+// Post-transform vertex cache ordering of triangle lists (Tom Forsyth's linear-speed
+// algorithm): triangles are emitted greedily by the score of their vertices, which
+// favours vertices recently used and vertices with few triangles left.
+class VertexCache {
+
+    private:
+
+    VertexCache() { }
+
+    static constexpr int cache_size = 32;
+
+    static float get_score(int position, int remaining) {
+        if (remaining == 0) {
+            return -1;
+        }
+
+        float score = 0;
+        if (position >= 0 && position < 3) {
+            score = 0.75f;
+        } else if (position >= 3) {
+            score = std::pow(1 - float(position - 3) / (cache_size - 3), 1.5f);
+        }
+        return score + 2 * std::pow(float(remaining), -0.5f);
+    }
+
+    // Whether corner c of triangle t repeats one of its earlier corners; a degenerate
+    // triangle is listed once per distinct vertex, and uses one cache entry for it.
+    template<typename T>
+    static bool is_repeated(const T* indices, size_t t, size_t c) {
+        return (c > 0 && indices[3 * t + c] == indices[3 * t]) || (c > 1 && indices[3 * t + c] == indices[3 * t + 1]);
+    }
+
+    public:
+
+    // Reorders the triangles of indices[0, count) in place; indices are below vertices_count.
+    template<typename T>
+    static void optimize(T* indices, size_t count, size_t vertices_count) {
+        size_t triangles_count = count / 3;
+
+        std::vector<int> remaining(vertices_count, 0);
+        for (size_t k = 0; k < triangles_count * 3; k++) {
+            if (!is_repeated(indices, k / 3, k % 3)) {
+                remaining[indices[k]]++;
+            }
+        }
+
+        std::vector<size_t> offsets(vertices_count + 1, 0);
+        for (size_t v = 0; v < vertices_count; v++) {
+            offsets[v + 1] = offsets[v] + remaining[v];
+        }
+
+        std::vector<size_t> triangles(offsets.back());
+        std::vector<size_t> filled(offsets.begin(), offsets.end() - 1);
+        for (size_t k = 0; k < triangles_count * 3; k++) {
+            if (!is_repeated(indices, k / 3, k % 3)) {
+                triangles[filled[indices[k]]++] = k / 3;
+            }
+        }
+
+        std::vector<int> position(vertices_count, -1);
+        std::vector<float> vertex_score(vertices_count);
+        for (size_t v = 0; v < vertices_count; v++) {
+            vertex_score[v] = get_score(-1, remaining[v]);
+        }
+
+        std::vector<float> triangle_score(triangles_count);
+        std::vector<bool> emitted(triangles_count, false);
+        for (size_t t = 0; t < triangles_count; t++) {
+            triangle_score[t] = 0;
+            for (size_t c = 0; c < 3; c++) {
+                if (!is_repeated(indices, t, c)) {
+                    triangle_score[t] += vertex_score[indices[3 * t + c]];
+                }
+            }
+        }
+
+        std::vector<T> result;
+        result.reserve(count);
+
+        std::vector<size_t> cache;
+        std::vector<size_t> next_cache;
+        size_t next_unemitted = 0;
+        long best = triangles_count > 0 ? 0 : -1;
+
+        for (size_t t = 0; t < triangles_count; t++) {
+            if (triangle_score[t] > triangle_score[best]) {
+                best = t;
+            }
+        }
+
+        while (result.size() < triangles_count * 3) {
+            if (best < 0) {
+                while (emitted[next_unemitted]) {
+                    next_unemitted++;
+                }
+                best = next_unemitted;
+            }
+
+            emitted[best] = true;
+            next_cache.clear();
+
+            for (size_t c = 0; c < 3; c++) {
+                size_t v = indices[3 * best + c];
+                result.push_back(v);
+                if (is_repeated(indices, best, c)) {
+                    continue;
+                }
+                next_cache.push_back(v);
+
+                size_t* begin = &triangles[offsets[v]];
+                size_t* end = begin + remaining[v];
+                std::iter_swap(std::find(begin, end, size_t(best)), end - 1);
+                remaining[v]--;
+            }
+
+            for (size_t v : cache) {
+                if (std::find(next_cache.begin(), next_cache.end(), v) == next_cache.end()) {
+                    next_cache.push_back(v);
+                }
+            }
+
+            for (size_t k = 0; k < next_cache.size(); k++) {
+                size_t v = next_cache[k];
+                position[v] = k < (size_t) cache_size ? k : -1;
+                vertex_score[v] = get_score(position[v], remaining[v]);
+            }
+
+            best = -1;
+            for (size_t v : next_cache) {
+                for (size_t k = offsets[v]; k < offsets[v] + remaining[v]; k++) {
+                    size_t t = triangles[k];
+                    triangle_score[t] = 0;
+                    for (size_t c = 0; c < 3; c++) {
+                        if (!is_repeated(indices, t, c)) {
+                            triangle_score[t] += vertex_score[indices[3 * t + c]];
+                        }
+                    }
+                    if (best < 0 || triangle_score[t] > triangle_score[best]) {
+                        best = t;
+                    }
+                }
+            }
+
+            if (next_cache.size() > (size_t) cache_size) {
+                next_cache.resize(cache_size);
+            }
+            std::swap(cache, next_cache);
+        }
+
+        std::copy(result.begin(), result.end(), indices);
+    }
+
+    // Average cache miss ratio: vertices transformed per triangle with a FIFO cache
+    // of cache_size entries, 0.5 at best for large regular grids and 3 at worst.
+    template<typename T>
+    static float get_acmr(const T* indices, size_t count, size_t cache_size = 32) {
+        if (count == 0) {
+            return 0;
+        }
+
+        size_t vertices_count = *std::max_element(indices, indices + count) + size_t(1);
+        std::vector<size_t> inserted(vertices_count, 0);
+        size_t misses = 0;
+
+        for (size_t k = 0; k < count; k++) {
+            size_t v = indices[k];
+            if (inserted[v] == 0 || misses - inserted[v] >= cache_size) {
+                misses++;
+                inserted[v] = misses;
+            }
+        }
+
+        return float(misses) / (count / 3);
+    }
+};
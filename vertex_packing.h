@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <glm/glm.hpp>
+
+
+// Encoders for the compact vertex formats, decoded in shaders/vertex_packing.glsl.
+
+// [0, 1] to a 16-bit UNORM.
+inline uint16_t pack_unorm16(float v) {
+    return (uint16_t) std::lround(std::clamp(v, 0.f, 1.f) * 65535.f);
+}
+
+// [-1, 1] to a 16-bit SNORM.
+inline int16_t pack_snorm16(float v) {
+    return (int16_t) std::lround(std::clamp(v, -1.f, 1.f) * 32767.f);
+}
+
+// v in the box [min, min + extent] to three 16-bit UNORMs.
+inline void pack_position(const glm::vec3& v, const glm::vec3& min, const glm::vec3& extent, uint16_t* packed) {
+    for (int k = 0; k < 3; k++) {
+        packed[k] = pack_unorm16((v[k] - min[k]) / extent[k]);
+    }
+}
+
+// A unit vector projected onto the octahedron |x| + |y| + |z| = 1, whose lower
+// half is folded over the upper one, leaving two SNORM components.
+inline void pack_normal(const glm::vec3& n, int16_t* packed) {
+    glm::vec2 e = glm::vec2(n.x, n.y) / (std::abs(n.x) + std::abs(n.y) + std::abs(n.z));
+    if (n.z < 0) {
+        e = glm::vec2(
+            (1 - std::abs(e.y)) * (e.x >= 0 ? 1 : -1),
+            (1 - std::abs(e.x)) * (e.y >= 0 ? 1 : -1)
+        );
+    }
+    packed[0] = pack_snorm16(e.x);
+    packed[1] = pack_snorm16(e.y);
+}
+
+// Extent of a quantization box, kept away from zero for flat boxes.
+inline glm::vec3 get_extent(const glm::vec3& min, const glm::vec3& max) {
+    return glm::max(max - min, glm::vec3(1e-6f));
+}